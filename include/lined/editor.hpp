@@ -0,0 +1,538 @@
+#pragma once
+
+#include "completion.hpp"
+#include "history.hpp"
+#include "key.hpp"
+#include "line.hpp"
+#include "output_buffer.hpp"
+#include "style.hpp"
+#include "style_runs.hpp"
+#include "terminal_line.hpp"
+#include "terminal_string.hpp"
+#include "utf8.hpp"
+#include "width_profile.hpp"
+#include <algorithm>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace lined {
+
+class editor;
+class line_reader;
+
+class styled_string
+{
+    friend editor;
+    friend line_reader;
+
+public:
+    styled_string() {}
+    styled_string(std::string_view str) : m_str(str) {}
+    styled_string& operator<<(std::string_view str) {
+        m_str += detail::terminal_string(str, local_id(m_cur_style));
+        return *this;
+    }
+    styled_string& operator<<(style s) {
+        m_cur_style = s;
+        return *this;
+    }
+
+private:
+    // The styles are numbered by this string, with 0 as the default, and renumbered into the editor's palette when a
+    // line starts with it.
+    detail::style_id local_id(detail::style_impl s) {
+        if (s == detail::style_impl{}) {
+            return 0;
+        }
+
+        auto it = std::find(m_styles.begin(), m_styles.end(), s);
+        if (it == m_styles.end()) {
+            m_styles.push_back(s);
+            it = m_styles.end() - 1;
+        }
+        return static_cast<detail::style_id>(it - m_styles.begin() + 1);
+    }
+
+    detail::terminal_string interned(detail::style_palette& palette) const {
+        auto str = m_str;
+        str.map_styles([&](detail::style_id id) { return id == 0 ? id : palette.intern(m_styles[id - 1]); });
+        return str;
+    }
+
+    detail::terminal_string m_str;
+    std::vector<detail::style_impl> m_styles;
+    style m_cur_style{};
+};
+
+class editor
+{
+public:
+    editor(int history_size = 100, bool auto_history = true, style hint_style = {.fg = color::gray()}) :
+        m_history(history_size), m_auto_history(auto_history), m_hint_style(hint_style) {}
+
+    void start(const styled_string& prompt) {
+        m_output.begin_frame();
+        m_output.write("\x1b[?2004h");
+        if (m_palette.size() > detail::style_palette::soft_limit) {
+            m_palette.clear();
+        }
+        m_line.emplace(m_output, m_palette, m_widths, m_columns, prompt.interned(m_palette), m_hint_callback,
+                       m_color_callback, m_incremental_color, m_masked, m_hint_style, m_soft_wrap);
+        m_line->set_callbacks_deferred(m_defer_callbacks);
+        m_output.end_frame();
+    }
+
+    void start(std::string_view prompt) { start(styled_string(prompt)); }
+
+    void stop() {
+        if (!m_line) {
+            return;
+        }
+
+        m_output.begin_frame();
+        m_line.reset();
+        m_output.write("\x1b[?2004l");
+        m_output.end_frame();
+        m_pasting = false;
+        m_paste.clear();
+        m_parser.flush();
+    }
+
+    bool active() const { return m_line.has_value(); }
+
+    std::optional<line> feed(std::string_view input) {
+        if (!m_pending.empty()) {
+            m_pending.append(input);
+            input = m_pending;
+        }
+
+        if (!m_line) {
+            if (input.data() != m_pending.data()) {
+                m_pending.assign(input);
+            }
+            return {};
+        }
+
+        std::optional<line> l;
+        std::size_t i = 0;
+        m_output.begin_frame();
+        m_line->begin_update();
+        while (!l && i < input.size()) {
+            l = process_byte(input[i]);
+            i += m_decoder.consumed();
+        }
+        if (m_line) {
+            m_line->end_update();
+        }
+        m_output.end_frame();
+
+        if (input.data() == m_pending.data()) {
+            m_pending.erase(0, i);
+        } else if (i < input.size()) {
+            m_pending.assign(input.substr(i));
+        }
+
+        return l;
+    }
+
+    std::string_view drain_output() { return m_output.drain(); }
+
+    void resize(int columns) {
+        if (columns == m_columns) {
+            return;
+        }
+
+        m_columns = columns;
+        if (m_line) {
+            m_output.begin_frame();
+            m_line->resize(columns);
+            m_output.end_frame();
+        }
+    }
+
+    bool escape_pending() const { return m_parser.pending() || m_sync_output_pending || m_width_probes_pending > 0; }
+
+    std::optional<line> expire_escape() {
+        // Gives up on unanswered queries. A reply cut off by the deadline is skipped rather than read as keys, and a
+        // reply that arrives later is ignored. Widths that were not all measured fall back to the defaults, and later
+        // cursor reports are keys again.
+        bool queried = std::exchange(m_sync_output_pending, false);
+        if (std::exchange(m_width_probes_pending, 0) > 0) {
+            queried = true;
+            m_parser.expect_cursor_reports(false);
+            set_widths(detail::width_profile{});
+        }
+        if (queried && m_parser.skip_sequence()) {
+            return {};
+        }
+
+        auto key = m_parser.flush();
+        if (!key || !m_line) {
+            return {};
+        }
+
+        m_output.begin_frame();
+        auto l = process_key(*key);
+        m_output.end_frame();
+        return l;
+    }
+
+    void defer_callbacks(bool defer) {
+        m_defer_callbacks = defer;
+        if (m_line) {
+            m_line->set_callbacks_deferred(defer);
+        }
+    }
+
+    bool callbacks_pending() const { return m_line && m_line->callbacks_pending(); }
+
+    void run_callbacks() {
+        if (m_line) {
+            m_output.begin_frame();
+            m_line->run_deferred_callbacks();
+            m_output.end_frame();
+        }
+    }
+
+    void query_synchronized_output() {
+        m_output.begin_frame();
+        m_output.write("\x1b[?2026$p");
+        m_output.end_frame();
+        m_sync_output_pending = true;
+    }
+
+    bool synchronized_output() const { return m_sync_output; }
+
+    // Prints a probe for each width_profile class at the start of the row and asks for the cursor position after it.
+    // Must be called before start, since it overwrites the current row.
+    void query_widths() {
+        m_output.begin_frame();
+        for (auto probe : detail::width_probes) {
+            m_output.write("\r");
+            m_output.write(probe);
+            m_output.write("\x1b[6n");
+        }
+        m_output.write("\r\x1b[K");
+        m_output.end_frame();
+        m_width_probes_pending = detail::width_probes.size();
+        m_parser.expect_cursor_reports(true);
+    }
+
+    bool widths_pending() const { return m_width_probes_pending > 0; }
+
+    const detail::width_profile& widths() const { return m_widths; }
+
+    void set_widths(const detail::width_profile& widths) {
+        m_widths = widths;
+        if (m_line) {
+            m_output.begin_frame();
+            m_line->set_width_profile(widths);
+            m_output.end_frame();
+        }
+    }
+
+    void clear_screen() {
+        m_output.begin_frame();
+        if (m_line) {
+            m_line->clear_screen();
+        } else {
+            m_output.write("\x1b[2J\x1b[1;1H");
+        }
+        m_output.end_frame();
+    }
+
+    void erase_line() {
+        if (m_line) {
+            m_output.begin_frame();
+            m_line->erase_line_visual();
+            m_output.end_frame();
+        }
+    }
+
+    void redraw() {
+        if (m_line) {
+            m_output.begin_frame();
+            m_line->redraw();
+            m_output.end_frame();
+        }
+    }
+
+    void print_above(std::string_view text) {
+        m_output.begin_frame();
+        if (m_line) {
+            m_line->erase_line_visual();
+        }
+
+        for (auto newline = text.find('\n'); newline != text.npos; newline = text.find('\n')) {
+            m_output.write(text.substr(0, newline));
+            m_output.write("\r\n");
+            text.remove_prefix(newline + 1);
+        }
+
+        if (!text.empty()) {
+            m_output.write(text);
+            m_output.write("\r\n");
+        }
+
+        if (m_line) {
+            m_line->redraw();
+        }
+        m_output.end_frame();
+    }
+
+    void set_soft_wrap(bool soft_wrap) { m_soft_wrap = soft_wrap; }
+
+    void mask() { m_masked = true; }
+    void unmask() { m_masked = false; }
+
+    void add_history(std::string_view str) { m_history.add(detail::decode_utf8(str)); }
+    void save_history(const std::string& path) { m_history.save(path); }
+    void load_history(const std::string& path) { m_history.load(path); }
+
+    void set_completion(std::function<completion_callback_t> callback) { m_completion.set_callback(callback); }
+    void set_hint(std::function<hint_callback_t> callback) {
+        if (callback) {
+            m_hint_callback = [callback = std::move(callback)](std::string_view str, text_edit) { return callback(str); };
+        } else {
+            m_hint_callback = nullptr;
+        }
+    }
+    void set_hint(std::function<hint_edit_callback_t> callback) { m_hint_callback = std::move(callback); }
+
+    void set_colorization(std::function<color_callback_t> callback) {
+        if (callback) {
+            m_color_callback = [callback = std::move(callback)](std::string_view str, text_edit, style_iterator iter) {
+                callback(str, iter);
+            };
+        } else {
+            m_color_callback = nullptr;
+        }
+        m_incremental_color = false;
+    }
+    void set_colorization(std::function<color_edit_callback_t> callback) {
+        m_color_callback = std::move(callback);
+        m_incremental_color = true;
+    }
+
+private:
+    std::optional<line> process_byte(char c) {
+        auto optional_wc = m_decoder.write_char(c);
+        if (!optional_wc) {
+            return {};
+        }
+
+        auto key = m_parser.feed(*optional_wc);
+        if (!key) {
+            return {};
+        }
+
+        return process_key(*key);
+    }
+
+    std::optional<line> process_key(const detail::key_event& key) {
+        if (m_pasting) {
+            if (key.code == detail::key_code::paste_end) {
+                m_pasting = false;
+                m_line->insert_string(m_paste);
+                m_paste.clear();
+                line_modified();
+            } else if (key.code == detail::key_code::character) {
+                paste_char(key.ch);
+            }
+
+            return {};
+        }
+
+        switch (key.code) {
+        case detail::key_code::character:
+            return process_char(key.ch);
+        case detail::key_code::del:
+            m_line->erase_current_character();
+            line_modified();
+            break;
+        case detail::key_code::left:
+            m_line->cursor_back();
+            break;
+        case detail::key_code::right:
+            m_line->cursor_forward();
+            break;
+        case detail::key_code::home:
+            m_line->cursor_home();
+            break;
+        case detail::key_code::end:
+            m_line->cursor_end();
+            break;
+        case detail::key_code::up:
+            if (!m_masked) {
+                auto new_line = m_history.record_and_go_back(m_line->current_line());
+                if (new_line) {
+                    m_line->set_line(*new_line);
+                    line_modified();
+                }
+            }
+            break;
+        case detail::key_code::down:
+            if (!m_masked) {
+                auto new_line = m_history.record_and_go_forward(m_line->current_line());
+                if (new_line) {
+                    m_line->set_line(*new_line);
+                    line_modified();
+                }
+            }
+            break;
+        case detail::key_code::paste_begin:
+            m_pasting = true;
+            m_paste_after_cr = false;
+            break;
+        case detail::key_code::mode_report:
+            if (key.mode == 2026 && std::exchange(m_sync_output_pending, false)) {
+                m_sync_output = key.mode_value >= 1 && key.mode_value <= 3;
+                m_output.set_synchronized(m_sync_output);
+            }
+            break;
+        case detail::key_code::cursor_report:
+            // Replies arrive in the order the probes were sent. Once they are all in or expire_escape has given up on
+            // them, CSI 1;2R is Shift+F3 again.
+            if (m_width_probes_pending > 0) {
+                auto i = detail::width_probes.size() - m_width_probes_pending--;
+                auto width = key.column - 1;
+                if (width == 1 || width == 2) {
+                    m_widths.widths[i] = width;
+                }
+                if (m_width_probes_pending == 0) {
+                    m_parser.expect_cursor_reports(false);
+                    m_line->set_width_profile(m_widths);
+                }
+            }
+            break;
+        default:
+            break;
+        }
+
+        return {};
+    }
+
+    std::optional<line> process_char(char32_t wc) {
+        switch (wc) {
+        case detail::key::enter:
+            line_modified();
+            if (m_line->empty()) {
+                m_line->new_line();
+            } else {
+                if (m_auto_history) {
+                    m_history.add(m_line->current_line());
+                }
+
+                auto l = m_line->pop_line();
+                stop();
+                return l;
+            }
+            break;
+        case detail::key::ctrl_d:
+            if (m_line->empty()) {
+                line_modified();
+                stop();
+                return line_error::ctrl_d;
+            } else {
+                m_line->erase_current_character();
+                line_modified();
+            }
+            break;
+        case detail::key::ctrl_c:
+            line_modified();
+            stop();
+            return line_error::ctrl_c;
+        case detail::key::backspace:
+        case detail::key::ctrl_h:
+            m_line->erase_previous_character();
+            line_modified();
+            break;
+        case detail::key::ctrl_u:
+            m_line->erase_line_backward();
+            line_modified();
+            break;
+        case detail::key::ctrl_k:
+            m_line->erase_line_forward();
+            line_modified();
+            break;
+        case detail::key::ctrl_a:
+            m_line->cursor_home();
+            break;
+        case detail::key::ctrl_e:
+            m_line->cursor_end();
+            break;
+        case detail::key::ctrl_t:
+            m_line->swap_characters();
+            line_modified();
+            break;
+        case detail::key::ctrl_w:
+            m_line->erase_previous_word();
+            line_modified();
+            break;
+        case detail::key::ctrl_l:
+            m_line->clear_screen();
+            break;
+        case detail::key::tab:
+            if (!m_masked) {
+                auto completion = m_completion.get_next_completion(m_line->current_line());
+                if (completion) {
+                    m_line->set_line(*completion);
+                }
+                break;
+            }
+            [[fallthrough]];
+        default:
+            m_line->insert_character(wc);
+            line_modified();
+            break;
+        }
+
+        return {};
+    }
+
+    void paste_char(char32_t wc) {
+        bool after_cr = std::exchange(m_paste_after_cr, wc == '\r');
+        if (wc == '\n' && after_cr) {
+            return;
+        }
+
+        if (wc == '\r' || wc == '\n' || wc == detail::key::tab) {
+            m_paste.push_back(' ');
+        } else if (wc >= 0x20 && wc != detail::key::backspace) {
+            m_paste.push_back(wc);
+        }
+    }
+
+    void line_modified() { m_completion.reset(); }
+
+    detail::output_buffer m_output;
+    detail::style_palette m_palette;
+    int m_columns = 80;
+    detail::utf8_decoder m_decoder;
+    detail::key_parser m_parser;
+    std::string m_pending;
+    std::optional<detail::terminal_line> m_line;
+    bool m_sync_output = false;
+    bool m_sync_output_pending = false;
+    detail::width_profile m_widths;
+    std::size_t m_width_probes_pending = 0;
+    bool m_defer_callbacks = false;
+    bool m_pasting = false;
+    bool m_paste_after_cr = false;
+    std::u32string m_paste;
+    detail::history m_history;
+    bool m_auto_history;
+    bool m_masked = false;
+    bool m_soft_wrap = false;
+    detail::completion m_completion;
+    std::function<hint_edit_callback_t> m_hint_callback;
+    std::function<color_edit_callback_t> m_color_callback;
+    bool m_incremental_color = false;
+    style m_hint_style;
+};
+
+} // namespace lined
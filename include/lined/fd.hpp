@@ -1,7 +1,9 @@
 #pragma once
 
-#include "utf8.hpp"
+#include <cerrno>
 #include <fcntl.h>
+#include <poll.h>
+#include <string_view>
 #include <termios.h>
 #include <unistd.h>
 
@@ -107,24 +109,18 @@ private:
     termios m_initial_termios;
 };
 
-class output_fd
-{
-public:
-    output_fd(int fd) : m_fd(fd) {}
-
-    void write(std::string_view str) {
-        if (str.size()) {
-            [[maybe_unused]] auto unused = ::write(m_fd, str.data(), str.size());
+inline void write_all(int fd, std::string_view str) {
+    while (!str.empty()) {
+        auto n_written = ::write(fd, str.data(), str.size());
+        if (n_written >= 0) {
+            str.remove_prefix(n_written);
+        } else if (errno == EAGAIN) {
+            pollfd poll_item{fd, POLLOUT, 0};
+            poll(&poll_item, 1, -1);
+        } else if (errno != EINTR) {
+            return;
         }
     }
-    void write(char c) { [[maybe_unused]] auto unused = ::write(m_fd, &c, 1); }
-    void write(std::u32string_view str) { write(encode_utf8(str)); }
-    void write(char32_t c) { write(encode_utf8({&c, 1})); }
-
-    int fd() const { return m_fd; }
-
-private:
-    int m_fd;
-};
+}
 
 } // namespace lined::detail
\ No newline at end of file
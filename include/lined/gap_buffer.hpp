@@ -0,0 +1,109 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+namespace lined::detail {
+
+template <typename T>
+class gap_buffer
+{
+    static constexpr std::size_t min_gap = 16;
+
+public:
+    gap_buffer() {}
+    gap_buffer(std::vector<T> items) : m_data(std::move(items)), m_gap_start(m_data.size()), m_gap_end(m_data.size()) {}
+
+    std::size_t size() const { return m_data.size() - gap_size(); }
+    bool empty() const { return size() == 0; }
+
+    const T& operator[](std::size_t i) const { return m_data[i < m_gap_start ? i : i + gap_size()]; }
+    T& operator[](std::size_t i) { return m_data[i < m_gap_start ? i : i + gap_size()]; }
+
+    const T* data() const {
+        move_gap(size());
+        return m_data.data();
+    }
+
+    // Where item i is stored, and how many items from the start are stored next to each other. Unlike data(), these
+    // leave the gap where it is.
+    const T* address(std::size_t i) const { return m_data.data() + (i < m_gap_start ? i : i + gap_size()); }
+    std::size_t gap_position() const { return m_gap_start; }
+
+    void insert(std::size_t i, std::size_t n, const T& value) {
+        make_gap(i, n);
+        std::fill_n(m_data.begin() + m_gap_start, n, value);
+        m_gap_start += n;
+    }
+
+    void insert(std::size_t i, const T& value) { insert(i, 1, value); }
+
+    template <typename It>
+    void insert(std::size_t i, It first, It last) {
+        auto n = static_cast<std::size_t>(std::distance(first, last));
+        make_gap(i, n);
+        std::copy(first, last, m_data.begin() + m_gap_start);
+        m_gap_start += n;
+    }
+
+    void push_back(const T& value) { insert(size(), value); }
+
+    void erase(std::size_t begin, std::size_t end) {
+        move_gap(begin);
+        m_gap_end += end - begin;
+    }
+
+    void clear() {
+        m_data.clear();
+        m_gap_start = 0;
+        m_gap_end = 0;
+    }
+
+    std::vector<T> slice(std::size_t begin, std::size_t end) const {
+        std::vector<T> items;
+        items.reserve(end - begin);
+        for (auto i = begin; i < end; ++i) {
+            items.push_back((*this)[i]);
+        }
+
+        return items;
+    }
+
+private:
+    std::size_t gap_size() const { return m_gap_end - m_gap_start; }
+
+    void move_gap(std::size_t i) const {
+        if (i < m_gap_start) {
+            std::move_backward(m_data.begin() + i, m_data.begin() + m_gap_start, m_data.begin() + m_gap_end);
+            m_gap_end -= m_gap_start - i;
+            m_gap_start = i;
+        } else if (i > m_gap_start) {
+            auto n = i - m_gap_start;
+            std::move(m_data.begin() + m_gap_end, m_data.begin() + m_gap_end + n, m_data.begin() + m_gap_start);
+            m_gap_start = i;
+            m_gap_end += n;
+        }
+    }
+
+    void make_gap(std::size_t i, std::size_t n) {
+        move_gap(i);
+        if (gap_size() >= n) {
+            return;
+        }
+
+        auto tail = m_data.size() - m_gap_end;
+        auto new_gap = std::max(n, std::max(size(), min_gap));
+        std::vector<T> data(m_gap_start + new_gap + tail);
+        std::move(m_data.begin(), m_data.begin() + m_gap_start, data.begin());
+        std::move(m_data.begin() + m_gap_end, m_data.end(), data.end() - tail);
+        m_data = std::move(data);
+        m_gap_end = m_gap_start + new_gap;
+    }
+
+    mutable std::vector<T> m_data;
+    mutable std::size_t m_gap_start = 0;
+    mutable std::size_t m_gap_end = 0;
+};
+
+} // namespace lined::detail
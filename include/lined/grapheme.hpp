@@ -0,0 +1,144 @@
+#pragma once
+
+#include "wcwidth9.hpp"
+#include <iterator>
+
+namespace lined::detail {
+
+enum class grapheme_break
+{
+    other,
+    cr,
+    lf,
+    control,
+    extend,
+    zwj,
+    regional_indicator,
+    pictographic,
+    l,
+    v,
+    t,
+    lv,
+    lvt,
+};
+
+constexpr wcwidth9_interval grapheme_control[] = {
+    {0x0000, 0x001f}, {0x007f, 0x009f}, {0x00ad, 0x00ad}, {0x061c, 0x061c}, {0x180e, 0x180e},
+    {0x200b, 0x200b}, {0x200e, 0x200f}, {0x2028, 0x202e}, {0x2060, 0x206f}, {0xfeff, 0xfeff},
+    {0xfff0, 0xfffb}, {0xe0000, 0xe001f}, {0xe0080, 0xe00ff}, {0xe01f0, 0xe0fff},
+};
+
+constexpr wcwidth9_interval grapheme_extend[] = {
+    {0x200c, 0x200c}, {0xfe00, 0xfe0f}, {0xff9e, 0xff9f}, {0x1f3fb, 0x1f3ff}, {0xe0020, 0xe007f}, {0xe0100, 0xe01ef},
+};
+
+constexpr wcwidth9_interval grapheme_pictographic[] = {
+    {0x00a9, 0x00a9},   {0x00ae, 0x00ae},   {0x203c, 0x203c},   {0x2049, 0x2049},   {0x2122, 0x2122},
+    {0x2139, 0x2139},   {0x2194, 0x2199},   {0x21a9, 0x21aa},   {0x231a, 0x231b},   {0x2328, 0x2328},
+    {0x2388, 0x2388},   {0x23cf, 0x23cf},   {0x23e9, 0x23f3},   {0x23f8, 0x23fa},   {0x24c2, 0x24c2},
+    {0x25aa, 0x25ab},   {0x25b6, 0x25b6},   {0x25c0, 0x25c0},   {0x25fb, 0x25fe},   {0x2600, 0x2605},
+    {0x2607, 0x2612},   {0x2614, 0x2685},   {0x2690, 0x2705},   {0x2708, 0x2712},   {0x2714, 0x2714},
+    {0x2716, 0x2716},   {0x271d, 0x271d},   {0x2721, 0x2721},   {0x2728, 0x2728},   {0x2733, 0x2734},
+    {0x2744, 0x2744},   {0x2747, 0x2747},   {0x274c, 0x274c},   {0x274e, 0x274e},   {0x2753, 0x2755},
+    {0x2757, 0x2757},   {0x2763, 0x2767},   {0x2795, 0x2797},   {0x27a1, 0x27a1},   {0x27b0, 0x27b0},
+    {0x27bf, 0x27bf},   {0x2934, 0x2935},   {0x2b05, 0x2b07},   {0x2b1b, 0x2b1c},   {0x2b50, 0x2b50},
+    {0x2b55, 0x2b55},   {0x3030, 0x3030},   {0x303d, 0x303d},   {0x3297, 0x3297},   {0x3299, 0x3299},
+    {0x1f000, 0x1f0ff}, {0x1f10d, 0x1f10f}, {0x1f12f, 0x1f12f}, {0x1f16c, 0x1f171}, {0x1f17e, 0x1f17f},
+    {0x1f18e, 0x1f18e}, {0x1f191, 0x1f19a}, {0x1f1ad, 0x1f1e5}, {0x1f201, 0x1f20f}, {0x1f21a, 0x1f21a},
+    {0x1f22f, 0x1f22f}, {0x1f232, 0x1f23a}, {0x1f23c, 0x1f23f}, {0x1f249, 0x1f3fa}, {0x1f400, 0x1f53d},
+    {0x1f546, 0x1f64f}, {0x1f680, 0x1f6ff}, {0x1f774, 0x1f77f}, {0x1f7d5, 0x1f7ff}, {0x1f80c, 0x1f80f},
+    {0x1f848, 0x1f84f}, {0x1f85a, 0x1f85f}, {0x1f888, 0x1f88f}, {0x1f8ae, 0x1f8ff}, {0x1f90c, 0x1f93a},
+    {0x1f93c, 0x1f945}, {0x1f947, 0x1faff}, {0x1fc00, 0x1fffd},
+};
+
+constexpr grapheme_break grapheme_property(char32_t c) {
+    if (c == '\r') {
+        return grapheme_break::cr;
+    } else if (c == '\n') {
+        return grapheme_break::lf;
+    } else if (c < 0x7f) {
+        return c < 0x20 ? grapheme_break::control : grapheme_break::other;
+    } else if (c == 0x200d) {
+        return grapheme_break::zwj;
+    } else if (c >= 0x1f1e6 && c <= 0x1f1ff) {
+        return grapheme_break::regional_indicator;
+    } else if (c >= 0x1100 && c <= 0x115f) {
+        return grapheme_break::l;
+    } else if (c >= 0xa960 && c <= 0xa97c) {
+        return grapheme_break::l;
+    } else if (c >= 0x1160 && c <= 0x11a7) {
+        return grapheme_break::v;
+    } else if (c >= 0xd7b0 && c <= 0xd7c6) {
+        return grapheme_break::v;
+    } else if (c >= 0x11a8 && c <= 0x11ff) {
+        return grapheme_break::t;
+    } else if (c >= 0xd7cb && c <= 0xd7fb) {
+        return grapheme_break::t;
+    } else if (c >= 0xac00 && c <= 0xd7a3) {
+        return (c - 0xac00) % 28 == 0 ? grapheme_break::lv : grapheme_break::lvt;
+    } else if (wcwidth9_intable(grapheme_control, std::size(grapheme_control), c)) {
+        return grapheme_break::control;
+    } else if (wcwidth9_intable(grapheme_extend, std::size(grapheme_extend), c) ||
+               (wcwidth9_norm(c) == 0 && wcwidth9_intable(wcwidth9_combining, std::size(wcwidth9_combining), c))) {
+        return grapheme_break::extend;
+    } else if (wcwidth9_intable(grapheme_pictographic, std::size(grapheme_pictographic), c)) {
+        return grapheme_break::pictographic;
+    }
+
+    return grapheme_break::other;
+}
+
+// Extended grapheme cluster segmentation after UAX #29, without the Prepend and SpacingMark rules. Feed code points
+// in order; next() reports whether a cluster starts at each one.
+class grapheme_segmenter
+{
+public:
+    bool next(char32_t c) {
+        auto prop = grapheme_property(c);
+        bool boundary = m_first || is_boundary(prop);
+
+        if (prop == grapheme_break::pictographic) {
+            m_pictographic = true;
+        } else if (boundary || (prop != grapheme_break::zwj &&
+                                (prop != grapheme_break::extend || m_prev == grapheme_break::zwj))) {
+            m_pictographic = false;
+        }
+        m_regional = prop == grapheme_break::regional_indicator ? (boundary ? 1 : m_regional + 1) : 0;
+        m_prev = prop;
+        m_first = false;
+        return boundary;
+    }
+
+private:
+    bool is_boundary(grapheme_break prop) const {
+        using gb = grapheme_break;
+        if (m_prev == gb::cr && prop == gb::lf) {
+            return false;
+        } else if (m_prev == gb::cr || m_prev == gb::lf || m_prev == gb::control) {
+            return true;
+        } else if (prop == gb::cr || prop == gb::lf || prop == gb::control) {
+            return true;
+        } else if (m_prev == gb::l && (prop == gb::l || prop == gb::v || prop == gb::lv || prop == gb::lvt)) {
+            return false;
+        } else if ((m_prev == gb::lv || m_prev == gb::v) && (prop == gb::v || prop == gb::t)) {
+            return false;
+        } else if ((m_prev == gb::lvt || m_prev == gb::t) && prop == gb::t) {
+            return false;
+        } else if (prop == gb::extend || prop == gb::zwj) {
+            return false;
+        } else if (m_prev == gb::zwj && prop == gb::pictographic && m_pictographic) {
+            return false;
+        } else if (m_prev == gb::regional_indicator && prop == gb::regional_indicator && m_regional % 2 == 1) {
+            return false;
+        }
+
+        return true;
+    }
+
+    grapheme_break m_prev = grapheme_break::other;
+    bool m_first = true;
+    bool m_pictographic = false;
+    int m_regional = 0;
+};
+
+} // namespace lined::detail
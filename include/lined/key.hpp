@@ -0,0 +1,330 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <utility>
+
+namespace lined::detail {
+
+namespace key {
+
+constexpr char32_t null = 0;
+constexpr char32_t ctrl_a = 1;
+constexpr char32_t ctrl_b = 2;
+constexpr char32_t ctrl_c = 3;
+constexpr char32_t ctrl_d = 4;
+constexpr char32_t ctrl_e = 5;
+constexpr char32_t ctrl_f = 6;
+constexpr char32_t ctrl_h = 8;
+constexpr char32_t tab = 9;
+constexpr char32_t ctrl_k = 11;
+constexpr char32_t ctrl_l = 12;
+constexpr char32_t enter = 13;
+constexpr char32_t ctrl_n = 14;
+constexpr char32_t ctrl_p = 16;
+constexpr char32_t ctrl_t = 20;
+constexpr char32_t ctrl_u = 21;
+constexpr char32_t ctrl_w = 23;
+constexpr char32_t esc = 27;
+constexpr char32_t backspace = 127;
+
+} // namespace key
+
+enum class key_code : uint8_t
+{
+    character,
+    alt_character,
+    escape,
+    up,
+    down,
+    right,
+    left,
+    home,
+    end,
+    insert,
+    del,
+    page_up,
+    page_down,
+    f1,
+    f2,
+    f3,
+    f4,
+    paste_begin,
+    paste_end,
+    mode_report,
+    cursor_report,
+    unknown
+};
+
+struct key_event
+{
+    key_code code;
+    char32_t ch = 0;
+    uint16_t modifiers = 0;
+    uint16_t mode = 0;
+    uint16_t mode_value = 0;
+    uint16_t column = 0;
+};
+
+enum class parser_state : uint8_t
+{
+    ground,
+    escape,
+    csi,
+    csi_intermediate,
+    csi_ignore,
+    ss3,
+    count
+};
+
+enum class parser_action : uint8_t
+{
+    none,
+    emit,
+    emit_escape,
+    emit_alt,
+    begin_csi,
+    param_digit,
+    param_next,
+    set_private,
+    intermediate,
+    dispatch_csi,
+    dispatch_ss3,
+    abort,
+    abort_emit
+};
+
+struct parser_transition
+{
+    parser_state next;
+    parser_action action;
+};
+
+constexpr std::size_t parser_columns = 129;
+
+constexpr std::size_t parser_column(char32_t c) {
+    return c < 128 ? c : 128;
+}
+
+constexpr auto make_parser_table() {
+    using s = parser_state;
+    using a = parser_action;
+    constexpr auto n_states = static_cast<std::size_t>(s::count);
+    std::array<std::array<parser_transition, parser_columns>, n_states> table{};
+
+    for (std::size_t c = 0; c < parser_columns; ++c) {
+        bool is_esc = c == key::esc;
+        bool is_param = c >= 0x30 && c <= 0x3f;
+        bool is_digit = c >= '0' && c <= '9';
+        bool is_separator = c == ';' || c == ':';
+        bool is_intermediate = c >= 0x20 && c <= 0x2f;
+        bool is_final = c >= 0x40 && c <= 0x7e;
+
+        auto& ground = table[static_cast<std::size_t>(s::ground)][c];
+        ground = is_esc ? parser_transition{s::escape, a::none} : parser_transition{s::ground, a::emit};
+
+        auto& escape = table[static_cast<std::size_t>(s::escape)][c];
+        if (c == '[') {
+            escape = {s::csi, a::begin_csi};
+        } else if (c == 'O') {
+            escape = {s::ss3, a::none};
+        } else if (is_esc) {
+            escape = {s::escape, a::emit_escape};
+        } else {
+            escape = {s::ground, a::emit_alt};
+        }
+
+        auto& csi = table[static_cast<std::size_t>(s::csi)][c];
+        if (is_digit) {
+            csi = {s::csi, a::param_digit};
+        } else if (is_separator) {
+            csi = {s::csi, a::param_next};
+        } else if (is_param) {
+            csi = {s::csi, a::set_private};
+        } else if (is_intermediate) {
+            csi = {s::csi_intermediate, a::intermediate};
+        } else if (is_final) {
+            csi = {s::ground, a::dispatch_csi};
+        } else if (is_esc) {
+            csi = {s::escape, a::abort};
+        } else {
+            csi = {s::ground, a::abort_emit};
+        }
+
+        auto& csi_intermediate = table[static_cast<std::size_t>(s::csi_intermediate)][c];
+        if (is_intermediate) {
+            csi_intermediate = {s::csi_intermediate, a::intermediate};
+        } else if (is_param) {
+            csi_intermediate = {s::csi_ignore, a::none};
+        } else if (is_final) {
+            csi_intermediate = {s::ground, a::dispatch_csi};
+        } else if (is_esc) {
+            csi_intermediate = {s::escape, a::abort};
+        } else {
+            csi_intermediate = {s::ground, a::abort_emit};
+        }
+
+        auto& csi_ignore = table[static_cast<std::size_t>(s::csi_ignore)][c];
+        if (is_final) {
+            csi_ignore = {s::ground, a::none};
+        } else if (is_esc) {
+            csi_ignore = {s::escape, a::abort};
+        } else {
+            csi_ignore = {s::csi_ignore, a::none};
+        }
+
+        auto& ss3 = table[static_cast<std::size_t>(s::ss3)][c];
+        if (is_final) {
+            ss3 = {s::ground, a::dispatch_ss3};
+        } else if (is_esc) {
+            ss3 = {s::escape, a::abort};
+        } else {
+            ss3 = {s::ground, a::abort_emit};
+        }
+    }
+
+    return table;
+}
+
+constexpr auto make_final_key_table() {
+    std::array<key_code, 0x3f> table{};
+    for (auto& k : table) {
+        k = key_code::unknown;
+    }
+
+    table['A' - 0x40] = key_code::up;
+    table['B' - 0x40] = key_code::down;
+    table['C' - 0x40] = key_code::right;
+    table['D' - 0x40] = key_code::left;
+    table['H' - 0x40] = key_code::home;
+    table['F' - 0x40] = key_code::end;
+    table['P' - 0x40] = key_code::f1;
+    table['Q' - 0x40] = key_code::f2;
+    table['R' - 0x40] = key_code::f3;
+    table['S' - 0x40] = key_code::f4;
+    return table;
+}
+
+constexpr std::array<key_code, 9> tilde_key_table = {
+    key_code::unknown,   key_code::home, key_code::insert, key_code::del, key_code::end,
+    key_code::page_up, key_code::page_down, key_code::home, key_code::end,
+};
+
+inline constexpr auto parser_table = make_parser_table();
+inline constexpr auto final_key_table = make_final_key_table();
+
+class key_parser
+{
+public:
+    std::optional<key_event> feed(char32_t c) {
+        auto t = parser_table[static_cast<std::size_t>(m_state)][parser_column(c)];
+        m_state = t.next;
+
+        switch (t.action) {
+        case parser_action::none:
+        case parser_action::abort:
+            return {};
+        case parser_action::emit:
+        case parser_action::abort_emit:
+            return key_event{key_code::character, c};
+        case parser_action::emit_escape:
+            return key_event{key_code::escape};
+        case parser_action::emit_alt:
+            return key_event{key_code::alt_character, c};
+        case parser_action::begin_csi:
+            m_params = {};
+            m_param_count = 1;
+            m_private = 0;
+            m_intermediate = 0;
+            return {};
+        case parser_action::param_digit:
+            if (m_param_count <= m_params.size()) {
+                auto& p = m_params[m_param_count - 1];
+                p = std::min(p * 10 + static_cast<int>(c - '0'), 0xffff);
+            }
+            return {};
+        case parser_action::param_next:
+            m_param_count++;
+            return {};
+        case parser_action::set_private:
+            m_private = c;
+            return {};
+        case parser_action::intermediate:
+            m_intermediate = c;
+            return {};
+        case parser_action::dispatch_csi:
+            return dispatch_csi(c);
+        case parser_action::dispatch_ss3:
+            return key_event{final_key_table[c - 0x40]};
+        }
+
+        return {};
+    }
+
+    std::optional<key_event> flush() {
+        auto state = std::exchange(m_state, parser_state::ground);
+        if (state == parser_state::escape) {
+            return key_event{key_code::escape};
+        }
+
+        return {};
+    }
+
+    bool pending() const { return m_state != parser_state::ground; }
+
+    // CSI row;column R is both a cursor position report and F3 with modifiers (CSI 1;2R is Shift+F3), so it is only
+    // read as a report while one is expected.
+    void expect_cursor_reports(bool expect) { m_cursor_reports = expect; }
+
+    // Discards the rest of an unfinished CSI sequence, up to and including its final byte. Returns false if there is
+    // none.
+    bool skip_sequence() {
+        if (m_state != parser_state::csi && m_state != parser_state::csi_intermediate &&
+            m_state != parser_state::csi_ignore) {
+            return false;
+        }
+
+        m_state = parser_state::csi_ignore;
+        return true;
+    }
+
+private:
+    key_event dispatch_csi(char32_t final_char) const {
+        if (m_private == '?' && m_intermediate == '$' && final_char == 'y') {
+            return {key_code::mode_report, 0, 0, m_params[0], m_params[1]};
+        } else if (m_cursor_reports && !m_private && !m_intermediate && final_char == 'R' && m_param_count == 2) {
+            return {key_code::cursor_report, 0, 0, 0, 0, m_params[1]};
+        } else if (m_private || m_intermediate) {
+            return {key_code::unknown};
+        }
+
+        key_code code;
+        if (final_char == '~') {
+            if (m_params[0] < tilde_key_table.size()) {
+                code = tilde_key_table[m_params[0]];
+            } else if (m_params[0] == 200) {
+                code = key_code::paste_begin;
+            } else if (m_params[0] == 201) {
+                code = key_code::paste_end;
+            } else {
+                code = key_code::unknown;
+            }
+        } else {
+            code = final_key_table[final_char - 0x40];
+        }
+
+        uint16_t modifiers = m_param_count > 1 && m_params[1] > 0 ? m_params[1] - 1 : 0;
+        return {code, 0, modifiers};
+    }
+
+    parser_state m_state = parser_state::ground;
+    std::array<uint16_t, 4> m_params = {};
+    std::size_t m_param_count = 0;
+    char32_t m_private = 0;
+    char32_t m_intermediate = 0;
+    bool m_cursor_reports = false;
+};
+
+} // namespace lined::detail
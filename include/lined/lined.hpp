@@ -1,48 +1,39 @@
 #pragma once
 
-#include "completion.hpp"
+#include "editor.hpp"
 #include "fd.hpp"
-#include "history.hpp"
 #include "line.hpp"
-#include "terminal_line.hpp"
-#include "utf8.hpp"
-#include <cstring>
-#include <deque>
+#include "print_queue.hpp"
+#include "resize.hpp"
+#include "watch.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <filesystem>
 #include <mutex>
 #include <optional>
 #include <poll.h>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <vector>
 #include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#if __cpp_impl_coroutine >= 201902L
+#include <coroutine>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#endif
 #include <termios.h>
 #include <unistd.h>
+#include <utility>
 
 namespace lined {
 
-namespace detail::key {
-
-constexpr char32_t null = 0;
-constexpr char32_t ctrl_a = 1;
-constexpr char32_t ctrl_b = 2;
-constexpr char32_t ctrl_c = 3;
-constexpr char32_t ctrl_d = 4;
-constexpr char32_t ctrl_e = 5;
-constexpr char32_t ctrl_f = 6;
-constexpr char32_t ctrl_h = 8;
-constexpr char32_t tab = 9;
-constexpr char32_t ctrl_k = 11;
-constexpr char32_t ctrl_l = 12;
-constexpr char32_t enter = 13;
-constexpr char32_t ctrl_n = 14;
-constexpr char32_t ctrl_p = 16;
-constexpr char32_t ctrl_t = 20;
-constexpr char32_t ctrl_u = 21;
-constexpr char32_t ctrl_w = 23;
-constexpr char32_t esc = 27;
-constexpr char32_t backspace = 127;
-
-} // namespace detail::key
-
 struct options
 {
     int in_fd;
@@ -50,65 +41,90 @@ struct options
     int history_size;
     bool auto_history;
     style hint_style;
+    std::chrono::milliseconds escape_timeout = std::chrono::milliseconds(50);
+    std::chrono::milliseconds callback_debounce = std::chrono::milliseconds(0);
+    bool soft_wrap = false;
+    std::size_t print_queue_size = 1024;
+    overflow_policy print_overflow = overflow_policy::block;
+    bool calibrate_widths = false;
 };
 
 constexpr options default_options{STDIN_FILENO, STDOUT_FILENO, 100, true, {.fg = color::gray()}};
 
-class line_reader;
+#if __cpp_impl_coroutine >= 201902L
+using reactor_callback_t = void(int, std::function<void()>);
 
-class styled_string
-{
-    friend line_reader;
+class getline_awaitable;
 
+// Thrown by async_getline when set_reactor has not been called.
+class missing_reactor : public std::exception
+{
 public:
-    styled_string() {}
-    styled_string(std::string_view str) : m_str(str) {}
-    styled_string& operator<<(std::string_view str) {
-        m_str += detail::terminal_string(str, m_cur_style);
-        return *this;
-    }
-    styled_string& operator<<(style s) {
-        m_cur_style = s;
-        return *this;
-    }
-
-private:
-    detail::terminal_string m_str;
-    style m_cur_style{};
+    const char* what() const noexcept override { return "lined: async_getline requires set_reactor"; }
 };
+#endif
+
+class session_host;
 
 class line_reader
 {
+    friend session_host;
+#if __cpp_impl_coroutine >= 201902L
+    friend getline_awaitable;
+#endif
+
 public:
     line_reader(options opt = default_options) :
-        m_in(opt.in_fd), m_out(opt.out_fd), m_cancel_fd(eventfd(0, O_NONBLOCK)), m_history(opt.history_size),
-        m_auto_history(opt.auto_history), m_hint_style(opt.hint_style) {}
+        m_in(opt.in_fd), m_out(opt.out_fd), m_wake_fd(eventfd(0, O_NONBLOCK)), m_resize(opt.out_fd),
+        m_editor(opt.history_size, opt.auto_history, opt.hint_style), m_escape_timeout(opt.escape_timeout),
+        m_callback_debounce(opt.callback_debounce), m_print_queue(opt.print_queue_size),
+        m_print_overflow(opt.print_overflow), m_calibrate_widths(opt.calibrate_widths) {
+        m_editor.set_soft_wrap(opt.soft_wrap);
+    }
 
     line getline(const styled_string& prompt) {
-        if (!m_line) {
+        m_reader_thread = std::this_thread::get_id();
+        if (!m_editor.active()) {
             activate(prompt);
         }
 
         while (true) {
-            pollfd poll_items[] = {{m_in.get(), POLLIN}, {m_cancel_fd.get(), POLLIN}};
-            poll(poll_items, std::size(poll_items), -1);
+            auto l = process_input();
+            if (l) {
+                deactivate();
+                return *l;
+            }
+
+            m_poll_items.clear();
+            m_poll_items.push_back({m_in.get(), POLLIN, 0});
+            m_poll_items.push_back({m_wake_fd.get(), POLLIN, 0});
+            m_poll_items.push_back({m_resize.fd(), POLLIN, 0});
+            m_watches.append_poll_items(m_poll_items);
 
-            if (poll_items[1].revents) {
-                uint64_t dummy_read;
-                [[maybe_unused]] auto unused = read(m_cancel_fd.get(), &dummy_read, sizeof(dummy_read));
+            auto timeout = min_timeout(deadline_timeout_ms(), m_watches.timeout_ms());
+            poll(m_poll_items.data(), m_poll_items.size(), timeout);
+
+            if (m_poll_items[1].revents && process_wake()) {
                 deactivate();
                 return line_error::cancelled;
             }
 
-            char char_read{};
-            if (read(m_in.get(), &char_read, 1) == -1) {
-                return line_error::syscall;
+            if ((m_poll_items[2].revents || m_resize.polled()) && m_resize.consume()) {
+                resize();
             }
 
-            auto l = process_single_char(char_read);
-            if (l) {
-                deactivate();
-                return *l;
+            m_watches.dispatch(m_poll_items.data() + 3, m_poll_items.size() - 3);
+
+            if (m_poll_items[0].revents) {
+                if (read_input() == -1) {
+                    return line_error::syscall;
+                }
+            } else {
+                l = expire_deadlines();
+                if (l) {
+                    deactivate();
+                    return *l;
+                }
             }
         }
     }
@@ -116,222 +132,641 @@ public:
     line getline(std::string_view prompt) { return getline(styled_string(prompt)); }
 
     std::optional<line> getline_nonblocking(const styled_string& prompt) {
-        if (!m_line) {
+        m_reader_thread = std::this_thread::get_id();
+        if (!m_editor.active()) {
             activate(prompt);
         }
 
-        uint64_t dummy_read;
-        if (read(m_cancel_fd.get(), &dummy_read, sizeof(dummy_read)) == sizeof(dummy_read)) {
+        if (process_wake()) {
             deactivate();
             return line_error::cancelled;
         }
 
-        char char_read;
-        int n_read = read(m_in.get(), &char_read, 1);
-        if (n_read == 0) {
-            return {};
-        } else if (n_read == -1) {
-            return line_error::syscall;
+        if (m_resize.consume()) {
+            resize();
         }
 
-        auto l = process_single_char(char_read);
-        if (l) {
-            deactivate();
-            return *l;
-        }
+        while (true) {
+            auto l = process_input();
+            if (l) {
+                deactivate();
+                return *l;
+            }
 
-        return {};
+            auto n_read = read_input();
+            if (n_read == 0) {
+                l = expire_deadlines();
+                if (l) {
+                    deactivate();
+                    return *l;
+                }
+                return {};
+            } else if (n_read == -1) {
+                return line_error::syscall;
+            }
+        }
     }
 
     std::optional<line> getline_nonblocking(std::string_view prompt) { return getline_nonblocking(styled_string(prompt)); }
 
+#if __cpp_impl_coroutine >= 201902L
+    void set_reactor(std::function<reactor_callback_t> reactor) { m_reactor = std::move(reactor); }
+
+    getline_awaitable async_getline(const styled_string& prompt);
+    getline_awaitable async_getline(std::string_view prompt);
+#endif
+
     void cancel() {
-        uint64_t to_write = 1;
-        write(m_cancel_fd.get(), &to_write, sizeof(to_write));
+        m_cancel_requested = true;
+        wake();
+    }
+
+    void print_above(std::string_view text) {
+        if (!m_active && write_inactive(text)) {
+            return;
+        }
+
+        std::string item(text);
+        bool reader_thread = std::this_thread::get_id() == m_reader_thread.load();
+        if (!reader_thread || !spill(item, false)) {
+            while (!m_print_queue.try_push(item)) {
+                if (m_print_overflow == overflow_policy::drop_newest) {
+                    m_dropped_output++;
+                    return;
+                } else if (m_print_overflow == overflow_policy::drop_oldest) {
+                    std::string discarded;
+                    if (m_print_queue.try_pop(discarded)) {
+                        m_dropped_output++;
+                    }
+                } else if (reader_thread) {
+                    spill(item, true);
+                    break;
+                } else {
+                    std::unique_lock lk(m_print_space_mutex);
+                    wake();
+                    m_print_space.wait(lk, [&] { return m_print_queue.try_push(item); });
+                    break;
+                }
+            }
+        }
+
+        wake();
+        if (!m_active) {
+            drain_inactive();
+        }
+    }
+
+    uint64_t dropped_output() const { return m_dropped_output; }
+
+    void refresh_geometry() {
+        m_resize_requested = true;
+        wake();
     }
 
     void clear_screen() {
-        if (m_line) {
-            m_line->clear_screen();
-        } else {
-            [[maybe_unused]] auto unused = write(m_out, "\x1b[2J\x1b[1;1H", 10);
+        if (!m_active) {
+            std::unique_lock lk(m_write_mutex, std::try_to_lock);
+            if (lk && !m_active) {
+                detail::write_all(m_out, "\x1b[2J\x1b[1;1H");
+                return;
+            }
         }
+
+        m_clear_requested = true;
+        wake();
     }
 
-    void mask() { m_masked = true; }
-    void unmask() { m_masked = false; }
+    void mask() { m_editor.mask(); }
+    void unmask() { m_editor.unmask(); }
 
-    void add_history(std::string_view str) { m_history.add(detail::decode_utf8(str)); }
-    void save_history(const std::string& path) { m_history.save(path); }
-    void load_history(const std::string& path) { m_history.load(path); }
+    void add_history(std::string_view str) { m_editor.add_history(str); }
+    void save_history(const std::string& path) { m_editor.save_history(path); }
+    void load_history(const std::string& path) { m_editor.load_history(path); }
 
-    void set_completion(std::function<completion_callback_t> callback) { m_completion.set_callback(callback); }
-    void set_hint(std::function<hint_callback_t> callback) { m_hint_callback = std::move(callback); }
-    void set_colorization(std::function<color_callback_t> callback) { m_color_callback = std::move(callback); }
+    void set_completion(std::function<completion_callback_t> callback) { m_editor.set_completion(std::move(callback)); }
+    void set_hint(std::function<hint_callback_t> callback) { m_editor.set_hint(std::move(callback)); }
+    void set_hint(std::function<hint_edit_callback_t> callback) { m_editor.set_hint(std::move(callback)); }
+    void set_colorization(std::function<color_callback_t> callback) {
+        m_editor.set_colorization(std::move(callback));
+    }
+    void set_colorization(std::function<color_edit_callback_t> callback) {
+        m_editor.set_colorization(std::move(callback));
+    }
+
+    void watch_fd(int fd, short events, std::function<watch_callback_t> callback) {
+        m_watches.watch(fd, events, std::move(callback));
+    }
+    void unwatch_fd(int fd) { m_watches.unwatch(fd); }
+
+    timer_id add_timer(std::chrono::milliseconds interval, std::function<timer_callback_t> callback) {
+        return m_watches.add_timer(interval, std::move(callback));
+    }
+    void remove_timer(timer_id id) { m_watches.remove_timer(id); }
 
     void disable_output() {
-        m_mutex.lock();
-        if (m_line) {
-            m_in.disable_raw_mode();
-            m_line->erase_line_visual();
+        if (std::this_thread::get_id() == m_reader_thread.load()) {
+            m_write_mutex.lock();
+            if (m_editor.active()) {
+                m_in.disable_raw_mode();
+                m_editor.erase_line();
+                flush_output();
+            }
+            return;
+        }
+
+        // The line belongs to the reader thread, so it is asked to erase the line and wait in process_wake until
+        // output is enabled again. activate and deactivate hold the write lock, so m_active is stable once it is held.
+        m_disable_mutex.lock();
+        std::unique_lock lk(m_park_mutex);
+        m_disable_requested = true;
+        while (true) {
+            wake();
+            m_park.wait(lk, [&] { return m_parked || !m_active; });
+            lk.unlock();
+            m_write_mutex.lock();
+            lk.lock();
+            if (m_parked || !m_active) {
+                return;
+            }
+            m_write_mutex.unlock();
         }
     }
 
     void enable_output() {
-        if (m_line) {
-            m_in.enable_raw_mode();
-            m_line->redraw();
+        if (std::this_thread::get_id() == m_reader_thread.load()) {
+            if (m_editor.active()) {
+                m_in.enable_raw_mode();
+                m_editor.redraw();
+                flush_output();
+            }
+            m_write_mutex.unlock();
+            return;
+        }
+
+        bool parked;
+        {
+            std::scoped_lock lk(m_park_mutex);
+            m_disable_requested = false;
+            parked = m_parked;
         }
-        m_mutex.unlock();
+        m_park.notify_all();
+        if (!m_active) {
+            write_print_queue();
+        }
+        m_write_mutex.unlock();
+
+        // Returns once the line is back in raw mode, like it does on the reader thread
+        if (parked) {
+            std::unique_lock lk(m_park_mutex);
+            m_park.wait(lk, [&] { return !m_parked; });
+        }
+        m_disable_mutex.unlock();
+        drain_inactive();
     }
 
 private:
     void activate(const styled_string& prompt) {
+        std::scoped_lock lk(m_write_mutex);
         m_in.enable_raw_mode();
-        m_line.emplace(m_out, prompt.m_str, m_hint_callback, m_color_callback, m_masked, m_hint_style);
+        if (!m_sync_output_queried && isatty(m_in.get()) && isatty(m_out)) {
+            m_editor.query_synchronized_output();
+            m_sync_output_queried = true;
+        }
+        if (m_calibrate_widths && isatty(m_in.get()) && isatty(m_out)) {
+            calibrate_widths();
+        }
+
+        m_editor.resize(terminal_columns());
+        m_editor.start(prompt);
+        flush_output();
+        m_active = true;
+
+        // Queries that are never answered expire like an unfinished escape sequence, even if no key is pressed
+        if (m_editor.escape_pending()) {
+            m_escape_deadline = std::chrono::steady_clock::now() + m_escape_timeout;
+        }
     }
 
     void deactivate() {
-        m_line.reset();
-        m_in.disable_raw_mode();
+        {
+            std::scoped_lock lk(m_write_mutex);
+            m_active = false;
+            m_editor.stop();
+            flush_output();
+            write_print_queue();
+            m_escape_deadline.reset();
+            m_callback_deadline.reset();
+            m_in.disable_raw_mode();
+        }
+
+        // Wakes a disable_output that was waiting for the line to be parked, so that it takes the write lock instead
+        {
+            std::scoped_lock lk(m_park_mutex);
+        }
+        m_park.notify_all();
+        drain_inactive();
     }
 
-    std::optional<line> process_single_char(char c) {
-        std::scoped_lock lk(m_mutex);
-
-        auto optional_wc = m_decoder.write_char(c);
-        if (!optional_wc) {
-            return {};
-        }
-
-        auto wc = *optional_wc;
-        if (m_chars_required) {
-            m_chars_required--;
-            m_escape_str.push_back(wc);
-            if (!m_chars_required) {
-                if (m_escape_str[0] == '[') {
-                    if (m_escape_str.size() == 3 && m_escape_str[1] == '3' && m_escape_str[2] == '~') {
-                        m_line->erase_current_character();
-                        line_modified();
-                    } else {
-                        if (m_escape_str[1] == '3') {
-                            m_chars_required++;
-                            return {};
-                        } else if (m_escape_str[1] == 'D') {
-                            m_line->cursor_back();
-                        } else if (m_escape_str[1] == 'C') {
-                            m_line->cursor_forward();
-                        } else if (m_escape_str[1] == 'H') {
-                            m_line->cursor_home();
-                        } else if (m_escape_str[1] == 'F') {
-                            m_line->cursor_end();
-                        } else if (m_escape_str[1] == 'A' && !m_masked) {
-                            auto new_line = m_history.record_and_go_back(m_line->current_line());
-                            if (new_line) {
-                                m_line->set_line(*new_line);
-                                line_modified();
-                            }
-                        } else if (m_escape_str[1] == 'B' && !m_masked) {
-                            auto new_line = m_history.record_and_go_forward(m_line->current_line());
-                            if (new_line) {
-                                m_line->set_line(*new_line);
-                                line_modified();
-                            }
-                        }
-                    }
-                } else if (m_escape_str[0] == 'O') {
-                    if (m_escape_str[1] == 'H') {
-                        m_line->cursor_home();
-                    } else if (m_escape_str[1] == 'F') {
-                        m_line->cursor_end();
-                    }
-                }
+    // Uses the widths cached for this $TERM, or measures them and caches the result once the replies are in.
+    void calibrate_widths() {
+        m_calibrate_widths = false;
+        m_width_cache_path = detail::width_cache_path();
+        if (auto widths = detail::load_width_profile(m_width_cache_path)) {
+            m_editor.set_widths(*widths);
+            m_width_cache_path.clear();
+        } else {
+            m_editor.query_widths();
+        }
+    }
+
+    void save_widths() {
+        if (!m_width_cache_path.empty() && !m_editor.widths_pending()) {
+            detail::save_width_profile(m_width_cache_path, m_editor.widths());
+            m_width_cache_path.clear();
+        }
+    }
+
+    void resize() {
+        m_editor.resize(terminal_columns());
+        flush_output();
+    }
+
+    int terminal_columns() const {
+        winsize ws;
+        if (ioctl(m_out, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0) {
+            return 80;
+        }
+
+        return ws.ws_col;
+    }
+
+    void wake() {
+        if (!m_wake_pending.exchange(true)) {
+            uint64_t to_write = 1;
+            [[maybe_unused]] auto unused = write(m_wake_fd.get(), &to_write, sizeof(to_write));
+        }
+    }
 
-                m_escape_str.clear();
+    bool process_wake() {
+        uint64_t dummy_read;
+        [[maybe_unused]] auto unused = read(m_wake_fd.get(), &dummy_read, sizeof(dummy_read));
+        m_wake_pending = false;
+
+        if (m_cancel_requested.exchange(false)) {
+            return true;
+        }
+
+        if (m_disable_requested) {
+            park();
+        }
+
+        if (m_resize_requested.exchange(false)) {
+            m_resize.consume();
+            resize();
+        }
+
+        m_print_batch.clear();
+        bool popped = false;
+        while (m_print_queue.try_pop(m_print_item)) {
+            popped = true;
+            m_print_batch.append(m_print_item);
+            if (!m_print_item.empty() && m_print_item.back() != '\n') {
+                m_print_batch.push_back('\n');
+            }
+        }
+        if (popped) {
+            notify_print_space();
+        }
+        take_spilled(m_print_spilled);
+        for (auto& text : m_print_spilled) {
+            m_print_batch.append(text);
+            if (!text.empty() && text.back() != '\n') {
+                m_print_batch.push_back('\n');
             }
+        }
+
+        if (m_clear_requested.exchange(false)) {
+            m_editor.clear_screen();
+        }
+        if (!m_print_batch.empty()) {
+            m_editor.print_above(m_print_batch);
+        }
+        flush_output();
+
+        return false;
+    }
 
-            return {};
+    // Erases the line for a disable_output on another thread, then waits for the matching enable_output.
+    void park() {
+        m_in.disable_raw_mode();
+        m_editor.erase_line();
+        flush_output();
+
+        {
+            std::unique_lock lk(m_park_mutex);
+            m_parked = true;
+            m_park.notify_all();
+            m_park.wait(lk, [&] { return !m_disable_requested; });
         }
 
-        if (wc == detail::key::enter) {
-            line_modified();
-            if (m_line->empty()) {
-                m_line->new_line();
-            } else {
-                if (m_auto_history) {
-                    m_history.add(m_line->current_line());
-                }
+        m_in.enable_raw_mode();
+        m_editor.redraw();
+        flush_output();
+
+        {
+            std::scoped_lock lk(m_park_mutex);
+            m_parked = false;
+        }
+        m_park.notify_all();
+    }
 
-                return m_line->pop_line();
+    // Must be called with the write lock held.
+    void write_print_queue() {
+        std::string text;
+        bool popped = false;
+        while (m_print_queue.try_pop(text)) {
+            detail::write_all(m_out, text);
+            popped = true;
+        }
+        if (popped) {
+            notify_print_space();
+        }
+        std::vector<std::string> spilled;
+        take_spilled(spilled);
+        for (auto& spilled_text : spilled) {
+            detail::write_all(m_out, spilled_text);
+        }
+    }
+
+    // Writes text straight to the terminal while no line is active. Rather than waiting while another thread writes,
+    // starts a line or has disabled output, it returns false and the text is queued for whoever holds the lock.
+    bool write_inactive(std::string_view text) {
+        {
+            std::unique_lock lk(m_write_mutex, std::try_to_lock);
+            if (!lk || m_active) {
+                return false;
             }
+            write_print_queue();
+            detail::write_all(m_out, text);
+        }
 
-        } else if (wc == detail::key::ctrl_d) {
-            if (m_line->empty()) {
-                line_modified();
-                return line_error::ctrl_d;
-            } else {
-                m_line->erase_current_character();
-                line_modified();
+        drain_inactive();
+        return true;
+    }
+
+    // Writes text that was queued while the write lock was taken, after whoever held it has released it.
+    void drain_inactive() {
+        while (!m_active && !m_print_queue.empty()) {
+            std::unique_lock lk(m_write_mutex, std::try_to_lock);
+            if (!lk) {
+                return;
             }
-        } else if (wc == detail::key::ctrl_c) {
-            line_modified();
-            return line_error::ctrl_c;
-        } else if (wc == detail::key::backspace || wc == detail::key::ctrl_h) {
-            m_line->erase_previous_character();
-            line_modified();
-        } else if (wc == detail::key::ctrl_u) {
-            m_line->erase_line_backward();
-            line_modified();
-        } else if (wc == detail::key::ctrl_k) {
-            m_line->erase_line_forward();
-            line_modified();
-        } else if (wc == detail::key::ctrl_a) {
-            m_line->cursor_home();
-        } else if (wc == detail::key::ctrl_e) {
-            m_line->cursor_end();
-        } else if (wc == detail::key::ctrl_t) {
-            m_line->swap_characters();
-            line_modified();
-        } else if (wc == detail::key::ctrl_w) {
-            m_line->erase_previous_word();
-            line_modified();
-        } else if (wc == detail::key::ctrl_l) {
-            m_line->clear_screen();
-        } else if (wc == detail::key::tab && !m_masked) {
-            auto completion = m_completion.get_next_completion(m_line->current_line());
-            if (completion) {
-                m_line->set_line(*completion);
+            if (!m_active) {
+                write_print_queue();
             }
-        } else if (wc == detail::key::esc) {
-            m_chars_required = 2;
-        } else {
-            m_line->insert_character(wc);
-            line_modified();
         }
+    }
+
+    // Only the reader thread drains the queue, so when it finds the queue full it sets its text aside instead of
+    // waiting for space. Once it has done so, its later text goes there too so that it stays in order.
+    bool spill(std::string& item, bool full) {
+        std::scoped_lock lk(m_print_space_mutex);
+        if (!full && m_print_spill.empty()) {
+            return false;
+        }
+
+        m_print_spill.push_back(std::move(item));
+        return true;
+    }
 
-        return {};
+    void take_spilled(std::vector<std::string>& spilled) {
+        spilled.clear();
+        std::scoped_lock lk(m_print_space_mutex);
+        spilled.swap(m_print_spill);
     }
 
-    void line_modified() { m_completion.reset(); }
+    // Wakes producers blocked on a full queue. Taking the mutex orders this after a producer's failed push, so the
+    // notification cannot be missed.
+    void notify_print_space() {
+        { std::scoped_lock lk(m_print_space_mutex); }
+        m_print_space.notify_all();
+    }
+
+    void flush_output() {
+        std::scoped_lock lk(m_write_mutex);
+        detail::write_all(m_out, m_editor.drain_output());
+    }
+
+    // Returns the number of bytes read, 0 if there was nothing to read, or -1 on error or at end of file. A terminal
+    // that has hung up stays readable, so treating end of file as nothing to read would spin.
+    ssize_t read_input() {
+        m_input_size = 0;
+
+        auto n_read = read(m_in.get(), m_input.data(), m_input.size());
+        if (n_read == -1) {
+            return errno == EAGAIN || errno == EINTR ? 0 : -1;
+        } else if (n_read == 0) {
+            return -1;
+        }
+
+        m_input_size = n_read;
+        return n_read;
+    }
+
+    bool input_ready() const {
+        pollfd item{m_in.get(), POLLIN, 0};
+        return poll(&item, 1, 0) == 1;
+    }
+
+    std::optional<line> process_input() {
+        auto input_size = std::exchange(m_input_size, 0);
+        bool burst = input_size > 0 && input_ready();
+        m_editor.defer_callbacks(burst || m_callback_debounce.count() > 0);
+
+        auto l = m_editor.feed({m_input.data(), input_size});
+        flush_output();
+        save_widths();
+
+        auto now = std::chrono::steady_clock::now();
+        if (!m_editor.escape_pending()) {
+            m_escape_deadline.reset();
+        } else if (!m_escape_deadline) {
+            m_escape_deadline = now + m_escape_timeout;
+        }
+
+        if (!m_editor.callbacks_pending()) {
+            m_callback_deadline.reset();
+        } else if (input_size > 0 || !m_callback_deadline) {
+            m_callback_deadline = now + m_callback_debounce;
+        }
+
+        return l;
+    }
+
+    std::optional<line> expire_deadlines() {
+        if (m_callback_deadline && timeout_ms(*m_callback_deadline) == 0) {
+            m_callback_deadline.reset();
+            m_editor.run_callbacks();
+        }
+
+        std::optional<line> l;
+        if (m_escape_deadline && timeout_ms(*m_escape_deadline) == 0) {
+            m_escape_deadline.reset();
+            // Widths that were never measured are not cached, so the next reader asks again
+            if (m_editor.widths_pending()) {
+                m_width_cache_path.clear();
+            }
+            l = m_editor.expire_escape();
+            if (m_editor.escape_pending()) {
+                m_escape_deadline = std::chrono::steady_clock::now() + m_escape_timeout;
+            }
+        }
+
+        flush_output();
+        return l;
+    }
+
+    bool deadline_pending() const { return m_escape_deadline || m_callback_deadline || m_resize.polled(); }
+
+    int deadline_timeout_ms() const {
+        auto timeout = min_timeout(m_escape_deadline ? timeout_ms(*m_escape_deadline) : -1,
+                                   m_callback_deadline ? timeout_ms(*m_callback_deadline) : -1);
+        return min_timeout(timeout, m_resize.timeout_ms());
+    }
+
+    static int timeout_ms(std::chrono::steady_clock::time_point deadline) {
+        auto remaining = deadline - std::chrono::steady_clock::now();
+        auto ms = std::chrono::ceil<std::chrono::milliseconds>(remaining).count();
+        return ms > 0 ? static_cast<int>(ms) : 0;
+    }
+
+    static int min_timeout(int a, int b) { return a == -1 || (b != -1 && b < a) ? b : a; }
+
+#if __cpp_impl_coroutine >= 201902L
+    void async_wait(std::function<void()> on_readable) {
+        if (m_wait_fd.get() == -1) {
+            m_wait_fd = epoll_create1(EPOLL_CLOEXEC);
+            m_escape_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+            for (int fd : {m_in.get(), m_wake_fd.get(), m_resize.fd(), m_escape_timer_fd.get()}) {
+                if (fd == -1) {
+                    continue;
+                }
+
+                epoll_event event{};
+                event.events = EPOLLIN;
+                event.data.fd = fd;
+                epoll_ctl(m_wait_fd.get(), EPOLL_CTL_ADD, fd, &event);
+            }
+        }
+
+        uint64_t expirations;
+        [[maybe_unused]] auto unused = read(m_escape_timer_fd.get(), &expirations, sizeof(expirations));
+
+        itimerspec timer{};
+        auto timeout = deadline_timeout_ms();
+        if (timeout != -1) {
+            auto ns = std::chrono::nanoseconds(std::chrono::milliseconds(std::max(timeout, 1)));
+            timer.it_value.tv_sec = std::chrono::duration_cast<std::chrono::seconds>(ns).count();
+            timer.it_value.tv_nsec = (ns % std::chrono::seconds(1)).count();
+        }
+        timerfd_settime(m_escape_timer_fd.get(), 0, &timer, nullptr);
+
+        m_reactor(m_wait_fd.get(), std::move(on_readable));
+    }
+
+    std::function<reactor_callback_t> m_reactor;
+    detail::unique_fd m_wait_fd;
+    detail::unique_fd m_escape_timer_fd;
+#endif
 
-    detail::utf8_decoder m_decoder;
-    termios m_initial_termios;
     detail::input_fd m_in;
     int m_out;
-    detail::unique_fd m_cancel_fd;
-    std::optional<detail::terminal_line> m_line;
-    int m_chars_required = 0;
-    std::string m_escape_str;
-    detail::history m_history;
-    bool m_auto_history;
-    bool m_masked = false;
-    detail::completion m_completion;
-    std::function<hint_callback_t> m_hint_callback;
-    std::function<color_callback_t> m_color_callback;
-    style m_hint_style;
-    std::mutex m_mutex;
+    detail::unique_fd m_wake_fd;
+    std::atomic<bool> m_wake_pending = false;
+    std::atomic<bool> m_cancel_requested = false;
+    detail::resize_listener m_resize;
+    editor m_editor;
+    std::vector<pollfd> m_poll_items;
+    detail::watch_set m_watches;
+    std::array<char, 4096> m_input;
+    std::size_t m_input_size = 0;
+    std::chrono::milliseconds m_escape_timeout;
+    std::optional<std::chrono::steady_clock::time_point> m_escape_deadline;
+    std::chrono::milliseconds m_callback_debounce;
+    std::optional<std::chrono::steady_clock::time_point> m_callback_deadline;
+    bool m_sync_output_queried = false;
+    std::atomic<bool> m_active = false;
+    std::atomic<bool> m_clear_requested = false;
+    detail::print_queue m_print_queue;
+    overflow_policy m_print_overflow;
+    bool m_calibrate_widths;
+    std::filesystem::path m_width_cache_path;
+    std::atomic<uint64_t> m_dropped_output = 0;
+    std::mutex m_print_space_mutex;
+    std::condition_variable m_print_space;
+    std::string m_print_batch;
+    std::string m_print_item;
+    std::vector<std::string> m_print_spill;
+    std::vector<std::string> m_print_spilled;
+    std::atomic<bool> m_resize_requested = false;
+    // The editor is only used by the thread that calls getline, and this lock is only taken to write to the
+    // terminal, to start or finish a line, and between disable_output and enable_output. Recursive so that
+    // print_above still works between disable_output and enable_output on the same thread.
+    std::recursive_mutex m_write_mutex;
+    std::atomic<std::thread::id> m_reader_thread;
+    // Serializes disable_output calls from threads other than the reader's
+    std::mutex m_disable_mutex;
+    std::mutex m_park_mutex;
+    std::condition_variable m_park;
+    bool m_parked = false;
+    std::atomic<bool> m_disable_requested = false;
 };
 
+#if __cpp_impl_coroutine >= 201902L
+class getline_awaitable
+{
+public:
+    getline_awaitable(line_reader& reader, styled_string prompt) : m_reader(reader), m_prompt(std::move(prompt)) {}
+
+    bool await_ready() {
+        m_result = m_reader.getline_nonblocking(m_prompt);
+        return m_result.has_value();
+    }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        m_handle = handle;
+        m_reader.async_wait([this] { on_readable(); });
+    }
+
+    line await_resume() { return std::move(*m_result); }
+
+private:
+    void on_readable() {
+        m_result = m_reader.getline_nonblocking(m_prompt);
+        if (m_result) {
+            m_handle.resume();
+        } else {
+            m_reader.async_wait([this] { on_readable(); });
+        }
+    }
+
+    line_reader& m_reader;
+    styled_string m_prompt;
+    std::optional<line> m_result;
+    std::coroutine_handle<> m_handle;
+};
+
+inline getline_awaitable line_reader::async_getline(const styled_string& prompt) {
+    if (!m_reactor) {
+        throw missing_reactor{};
+    }
+
+    return {*this, prompt};
+}
+
+inline getline_awaitable line_reader::async_getline(std::string_view prompt) { return async_getline(styled_string(prompt)); }
+#endif
+
 class scoped_disable
 {
 public:
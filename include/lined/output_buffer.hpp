@@ -0,0 +1,91 @@
+#pragma once
+
+#include "utf8.hpp"
+#include <string>
+#include <string_view>
+
+namespace lined::detail {
+
+class output_buffer
+{
+    static constexpr std::string_view begin_sync = "\x1b[?2026h";
+    static constexpr std::string_view end_sync = "\x1b[?2026l";
+
+public:
+    void write(std::string_view str) {
+        reset_if_drained();
+        m_buf.append(str);
+    }
+    void write(char c) {
+        reset_if_drained();
+        m_buf.push_back(c);
+    }
+    void write(std::u32string_view str) {
+        reset_if_drained();
+        encode_utf8(str, m_buf);
+    }
+    void write(char32_t c) {
+        reset_if_drained();
+        append_utf8(m_buf, c);
+    }
+
+    void write_csi(int n, char final) {
+        char digits[16];
+        int i = sizeof(digits);
+        do {
+            digits[--i] = static_cast<char>('0' + n % 10);
+            n /= 10;
+        } while (n > 0);
+
+        write("\x1b[");
+        m_buf.append(digits + i, sizeof(digits) - i);
+        m_buf.push_back(final);
+    }
+
+    void begin_frame() {
+        if (m_frame_depth++ == 0) {
+            reset_if_drained();
+            m_frame_start = m_buf.size();
+            m_frame_synchronized = m_synchronized;
+            if (m_frame_synchronized) {
+                m_buf.append(begin_sync);
+            }
+        }
+    }
+
+    void end_frame() {
+        if (--m_frame_depth == 0 && m_frame_synchronized) {
+            if (m_buf.size() == m_frame_start + begin_sync.size()) {
+                m_buf.resize(m_frame_start);
+            } else {
+                m_buf.append(end_sync);
+            }
+        }
+    }
+
+    std::string_view drain() {
+        reset_if_drained();
+        m_drained = true;
+        return m_buf;
+    }
+
+    void set_synchronized(bool synchronized) { m_synchronized = synchronized; }
+
+private:
+    void reset_if_drained() {
+        if (m_drained) {
+            m_drained = false;
+            m_buf.clear();
+            m_frame_start = 0;
+        }
+    }
+
+    std::string m_buf;
+    std::size_t m_frame_start = 0;
+    int m_frame_depth = 0;
+    bool m_synchronized = false;
+    bool m_frame_synchronized = false;
+    bool m_drained = false;
+};
+
+} // namespace lined::detail
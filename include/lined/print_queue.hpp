@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <utility>
+
+namespace lined {
+
+enum class overflow_policy
+{
+    block,
+    drop_oldest,
+    drop_newest
+};
+
+namespace detail {
+
+class print_queue
+{
+public:
+    print_queue(std::size_t capacity) {
+        // With a single cell, a full cell's sequence would match the next push position
+        std::size_t size = 2;
+        while (size < capacity) {
+            size *= 2;
+        }
+
+        m_mask = size - 1;
+        m_cells = std::make_unique<cell[]>(size);
+        for (std::size_t i = 0; i < size; ++i) {
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    bool try_push(std::string& text) {
+        auto pos = m_push_pos.load(std::memory_order_relaxed);
+        while (true) {
+            auto& c = m_cells[pos & m_mask];
+            auto sequence = c.sequence.load(std::memory_order_acquire);
+            auto diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos);
+            if (diff == 0) {
+                if (m_push_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    c.text = std::move(text);
+                    c.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = m_push_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool try_pop(std::string& text) {
+        auto pos = m_pop_pos.load(std::memory_order_relaxed);
+        while (true) {
+            auto& c = m_cells[pos & m_mask];
+            auto sequence = c.sequence.load(std::memory_order_acquire);
+            auto diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos + 1);
+            if (diff == 0) {
+                if (m_pop_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    text = std::move(c.text);
+                    c.text.clear();
+                    c.sequence.store(pos + m_mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = m_pop_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Only a hint while other threads push or pop: a text whose push is still in progress already counts.
+    bool empty() const { return m_push_pos.load() == m_pop_pos.load(); }
+
+private:
+    struct cell
+    {
+        std::atomic<std::size_t> sequence;
+        std::string text;
+    };
+
+    std::unique_ptr<cell[]> m_cells;
+    std::size_t m_mask;
+    alignas(64) std::atomic<std::size_t> m_push_pos = 0;
+    alignas(64) std::atomic<std::size_t> m_pop_pos = 0;
+};
+
+} // namespace detail
+
+} // namespace lined
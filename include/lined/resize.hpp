@@ -0,0 +1,145 @@
+#pragma once
+
+#include "fd.hpp"
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <mutex>
+#include <sys/eventfd.h>
+#include <thread>
+#include <unistd.h>
+
+namespace lined::detail {
+
+class resize_listener
+{
+    static constexpr std::size_t max_listeners = 64;
+    static constexpr auto poll_interval = std::chrono::milliseconds(250);
+
+    using clock = std::chrono::steady_clock;
+
+public:
+    resize_listener() {}
+    resize_listener(int tty_fd) {
+        if (tcgetpgrp(tty_fd) == -1) {
+            return;
+        }
+
+        // Without an eventfd or a free slot, the geometry is polled instead
+        m_polled = true;
+        int event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (event_fd == -1) {
+            return;
+        }
+
+        for (auto& slot : s_slots) {
+            int expected = 0;
+            if (slot.compare_exchange_strong(expected, event_fd + 1)) {
+                m_slot = &slot;
+                m_fd = event_fd;
+                m_polled = false;
+                break;
+            }
+        }
+
+        if (!m_slot) {
+            close(event_fd);
+            return;
+        }
+
+        static std::once_flag install_flag;
+        std::call_once(install_flag, install_handler);
+    }
+
+    resize_listener(const resize_listener&) = delete;
+    resize_listener& operator=(const resize_listener&) = delete;
+
+    // A handler that read the slot before it was cleared may still be about to write to the eventfd, so it is only
+    // closed once no handler is running.
+    ~resize_listener() {
+        if (m_slot) {
+            m_slot->store(0);
+            while (s_in_flight.load() > 0) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    int fd() const { return m_fd.get(); }
+
+    // Whether the terminal's geometry has to be polled because no SIGWINCH notification is available.
+    bool polled() const { return m_polled; }
+
+    // Milliseconds until the geometry should next be polled, or -1.
+    int timeout_ms() const {
+        if (!m_polled) {
+            return -1;
+        }
+
+        auto ms = std::chrono::ceil<std::chrono::milliseconds>(m_next_poll - clock::now()).count();
+        return ms > 0 ? static_cast<int>(ms) : 0;
+    }
+
+    bool consume() {
+        if (m_polled) {
+            auto now = clock::now();
+            if (now < m_next_poll) {
+                return false;
+            }
+
+            m_next_poll = now + poll_interval;
+            return true;
+        }
+
+        uint64_t count;
+        return m_fd.get() != -1 && read(m_fd.get(), &count, sizeof(count)) == sizeof(count);
+    }
+
+private:
+    static void install_handler() {
+        struct sigaction action = {};
+        action.sa_sigaction = on_signal;
+        action.sa_flags = SA_RESTART | SA_SIGINFO;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGWINCH, &action, &s_previous_action);
+    }
+
+    static void on_signal(int signal, siginfo_t* info, void* context) {
+        s_in_flight++;
+        int saved_errno = errno;
+        for (auto& slot : s_slots) {
+            int fd = slot.load() - 1;
+            if (fd >= 0) {
+                uint64_t to_write = 1;
+                [[maybe_unused]] auto unused = write(fd, &to_write, sizeof(to_write));
+            }
+        }
+        errno = saved_errno;
+        s_in_flight--;
+
+        if (s_previous_action.sa_flags & SA_SIGINFO) {
+            if (s_previous_action.sa_sigaction) {
+                s_previous_action.sa_sigaction(signal, info, context);
+            }
+        } else {
+            auto previous = s_previous_action.sa_handler;
+            if (previous != SIG_DFL && previous != SIG_IGN && previous) {
+                previous(signal);
+            }
+        }
+    }
+
+    inline static std::array<std::atomic<int>, max_listeners> s_slots = {};
+    inline static std::atomic<int> s_in_flight = 0;
+    inline static struct sigaction s_previous_action = {};
+
+    std::atomic<int>* m_slot = nullptr;
+    unique_fd m_fd;
+    bool m_polled = false;
+    clock::time_point m_next_poll;
+};
+
+} // namespace lined::detail
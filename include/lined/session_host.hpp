@@ -0,0 +1,156 @@
+#pragma once
+
+#include "lined.hpp"
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unordered_map>
+#include <vector>
+
+namespace lined {
+
+using session_line_callback_t = void(line_reader&, line);
+
+class session_host
+{
+public:
+    session_host() : m_epoll_fd(epoll_create1(EPOLL_CLOEXEC)), m_stop_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.ptr = nullptr;
+        epoll_ctl(m_epoll_fd.get(), EPOLL_CTL_ADD, m_stop_fd.get(), &event);
+    }
+
+    void add(line_reader& reader, styled_string prompt, std::function<session_line_callback_t> on_line) {
+        remove(reader);
+
+        auto s = std::make_unique<session>(session{&reader, std::move(prompt), std::move(on_line)});
+        for (int fd : {reader.m_in.get(), reader.m_wake_fd.get(), reader.m_resize.fd()}) {
+            if (fd == -1) {
+                continue;
+            }
+
+            epoll_event event{};
+            event.events = EPOLLIN;
+            event.data.ptr = s.get();
+            epoll_ctl(m_epoll_fd.get(), EPOLL_CTL_ADD, fd, &event);
+        }
+
+        auto& added = *s;
+        m_sessions.emplace(&reader, std::move(s));
+        service(added);
+    }
+
+    void remove(line_reader& reader) {
+        auto it = m_sessions.find(&reader);
+        if (it == m_sessions.end()) {
+            return;
+        }
+
+        for (int fd : {reader.m_in.get(), reader.m_wake_fd.get(), reader.m_resize.fd()}) {
+            if (fd != -1) {
+                epoll_ctl(m_epoll_fd.get(), EPOLL_CTL_DEL, fd, nullptr);
+            }
+        }
+
+        m_deadline_pending.erase(std::remove(m_deadline_pending.begin(), m_deadline_pending.end(), it->second.get()),
+                               m_deadline_pending.end());
+        it->second->removed = true;
+        m_removed.push_back(std::move(it->second));
+        m_sessions.erase(it);
+    }
+
+    std::size_t size() const { return m_sessions.size(); }
+
+    void run_once(int timeout_ms = -1) {
+        for (auto* s : m_deadline_pending) {
+            timeout_ms = line_reader::min_timeout(timeout_ms, s->reader->deadline_timeout_ms());
+        }
+
+        m_events.resize(std::max<std::size_t>(m_sessions.size(), 1) + 1);
+        int n_events = epoll_wait(m_epoll_fd.get(), m_events.data(), m_events.size(), timeout_ms);
+
+        for (int i = 0; i < n_events; ++i) {
+            auto* s = static_cast<session*>(m_events[i].data.ptr);
+            if (!s) {
+                uint64_t dummy_read;
+                [[maybe_unused]] auto unused = read(m_stop_fd.get(), &dummy_read, sizeof(dummy_read));
+            } else if (!s->removed) {
+                service(*s);
+            }
+        }
+
+        auto pending = std::move(m_deadline_pending);
+        m_deadline_pending.clear();
+        for (auto* s : pending) {
+            s->deadline_pending = false;
+            if (!s->removed) {
+                if (s->reader->deadline_timeout_ms() == 0) {
+                    service(*s);
+                } else {
+                    track_deadline(*s);
+                }
+            }
+        }
+
+        m_removed.clear();
+    }
+
+    void run() {
+        m_stopped = false;
+        while (!m_stopped) {
+            run_once();
+        }
+    }
+
+    void stop() {
+        m_stopped = true;
+        uint64_t to_write = 1;
+        [[maybe_unused]] auto unused = write(m_stop_fd.get(), &to_write, sizeof(to_write));
+    }
+
+private:
+    struct session
+    {
+        line_reader* reader;
+        styled_string prompt;
+        std::function<session_line_callback_t> on_line;
+        bool removed = false;
+        bool deadline_pending = false;
+    };
+
+    void service(session& s) {
+        while (!s.removed) {
+            auto l = s.reader->getline_nonblocking(s.prompt);
+            if (!l) {
+                track_deadline(s);
+                return;
+            }
+
+            s.on_line(*s.reader, std::move(*l));
+            if (s.reader->m_editor.active()) {
+                return;
+            }
+        }
+    }
+
+    void track_deadline(session& s) {
+        if (!s.deadline_pending && s.reader->deadline_pending()) {
+            s.deadline_pending = true;
+            m_deadline_pending.push_back(&s);
+        }
+    }
+
+    detail::unique_fd m_epoll_fd;
+    detail::unique_fd m_stop_fd;
+    std::unordered_map<line_reader*, std::unique_ptr<session>> m_sessions;
+    std::vector<std::unique_ptr<session>> m_removed;
+    std::vector<session*> m_deadline_pending;
+    std::vector<epoll_event> m_events;
+    std::atomic<bool> m_stopped = false;
+};
+
+} // namespace lined
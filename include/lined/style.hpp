@@ -4,7 +4,9 @@
 #include <array>
 #include <cstdint>
 #include <string>
+#include <vector>
 
+#include "gap_buffer.hpp"
 #include "utf8.hpp"
 
 namespace lined {
@@ -96,43 +98,88 @@ public:
         }
     }
 
-    static std::string switch_to(style_impl& from, const style_impl& to) {
+    static void append_transition(std::string& out, const style_impl& from, const style_impl& to) {
+        const auto& f = from.m_style;
         const auto& s = to.m_style;
-        if (from.m_style == s) {
-            return {};
+        if (f == s) {
+            return;
+        } else if (to == style_impl{}) {
+            out += "\x1b[0m";
+            return;
         }
 
-        std::string out = "\x1b[0;";
-        if (s[0] == 1) {
-            out += "1;";
+        out += "\x1b[";
+        if (s[0] != f[0]) {
+            out += s[0] == 1 ? "1;" : "22;";
         }
-        if (s[1] & 1 << 3) {
-            if (s[1] & 1 << 2) {
-                out += "38;2;" + std::to_string(s[2]) + ';' + std::to_string(s[3]) + ';' + std::to_string(s[4]) + ';';
-            } else {
-                out += "38;5;" + std::to_string(s[2]) + ';';
-            }
+        if ((s[1] & 0b1100) != (f[1] & 0b1100) || !std::equal(&s[2], &s[5], &f[2])) {
+            append_color(out, s[1] >> 2, &s[2], "38", "39");
         }
-        if (s[1] & 1 << 1) {
-            if (s[1] & 1 << 0) {
-                out += "38;2;" + std::to_string(s[5]) + ';' + std::to_string(s[6]) + ';' + std::to_string(s[7]) + ';';
-            } else {
-                out += "38;5;" + std::to_string(s[5]) + ';';
-            }
+        if ((s[1] & 0b0011) != (f[1] & 0b0011) || !std::equal(&s[5], &s[8], &f[5])) {
+            append_color(out, s[1], &s[5], "48", "49");
         }
-
         out.back() = 'm';
-        from = to;
-        return out;
+    }
+
+    uint64_t key() const {
+        uint64_t k = 0;
+        for (auto b : m_style) {
+            k = k << 8 | b;
+        }
+
+        return k;
     }
 
     bool operator==(const style_impl& other) const { return m_style == other.m_style; }
     bool operator!=(const style_impl& other) const { return !operator==(other); }
 
 private:
+    static void append_color(std::string& out, uint8_t flags, const uint8_t* color, const char* set, const char* reset) {
+        if (!(flags & 1 << 1)) {
+            out += reset;
+        } else if (flags & 1 << 0) {
+            out += set;
+            out += ";2";
+            for (int i = 0; i < 3; ++i) {
+                out += ';';
+                append_number(out, color[i]);
+            }
+        } else {
+            out += set;
+            out += ";5;";
+            append_number(out, color[0]);
+        }
+        out += ';';
+    }
+
+    static void append_number(std::string& out, uint8_t n) {
+        if (n >= 100) {
+            out += static_cast<char>('0' + n / 100);
+        }
+        if (n >= 10) {
+            out += static_cast<char>('0' + n / 10 % 10);
+        }
+        out += static_cast<char>('0' + n % 10);
+    }
+
     std::array<uint8_t, 8> m_style = {};
 };
 
+// The code points a style_iterator has written to. written is indexed by code point and is only nonzero inside
+// [begin, end), so clearing that range resets it.
+struct style_window
+{
+    std::size_t begin = -1;
+    std::size_t end = 0;
+    std::vector<uint8_t> written;
+
+    void mark(std::size_t i) {
+        begin = std::min(begin, i);
+        end = std::max(end, i + 1);
+        written[i] = 1;
+    }
+};
+
 } // namespace detail
 
 class style_iterator
@@ -144,19 +191,28 @@ public:
     using value_type = void;
     using difference_type = std::ptrdiff_t;
 
-    style_iterator(const char* str, std::vector<detail::style_impl>& style) : m_str(str), m_out(style.begin()) {}
+    // The text is addressed by byte offset rather than by pointer, so the iterator stays valid when the callback makes
+    // the text contiguous.
+    style_iterator(const detail::gap_buffer<char>& text, std::vector<detail::style_impl>& style) :
+        m_text(&text), m_out(style.begin()) {}
+    style_iterator(const detail::gap_buffer<char>& text, std::size_t offset, std::vector<detail::style_impl>& style,
+                   std::size_t i, detail::style_window& written) :
+        m_text(&text), m_offset(offset), m_out(style.begin() + i), m_first(style.begin()), m_written(&written) {}
 
     style_iterator& operator*() { return *this; }
     style_iterator operator[](int n) const { return *this + n; }
     
     style_iterator& operator=(const style& s) {
         *m_out = s;
+        if (m_written) {
+            m_written->mark(m_out - m_first);
+        }
         return *this;
     }
 
     style_iterator& operator++() {
-        m_str++;
-        if (!detail::is_continuation_byte(*m_str)) {
+        m_offset++;
+        if (!detail::is_continuation_byte((*m_text)[m_offset])) {
             m_out++;
         }
         return *this;
@@ -167,10 +223,10 @@ public:
         return old;
     }
     style_iterator& operator--() {
-        if (!detail::is_continuation_byte(*m_str)) {
+        if (!detail::is_continuation_byte((*m_text)[m_offset])) {
             m_out--;
         }
-        m_str--;
+        m_offset--;
         return *this;
     }
     style_iterator operator--(int) {
@@ -201,16 +257,19 @@ public:
         return s;
     }
     
-    bool operator==(const style_iterator& other) const { return m_str == other.m_str; }
-    bool operator!=(const style_iterator& other) const { return m_str != other.m_str; }
-    bool operator<(const style_iterator& other) const { return m_str < other.m_str; }
-    bool operator>(const style_iterator& other) const { return m_str > other.m_str; }
-    bool operator<=(const style_iterator& other) const { return m_str <= other.m_str; }
-    bool operator>=(const style_iterator& other) const { return m_str >= other.m_str; }
+    bool operator==(const style_iterator& other) const { return m_offset == other.m_offset; }
+    bool operator!=(const style_iterator& other) const { return m_offset != other.m_offset; }
+    bool operator<(const style_iterator& other) const { return m_offset < other.m_offset; }
+    bool operator>(const style_iterator& other) const { return m_offset > other.m_offset; }
+    bool operator<=(const style_iterator& other) const { return m_offset <= other.m_offset; }
+    bool operator>=(const style_iterator& other) const { return m_offset >= other.m_offset; }
 
 private:
-    const char* m_str;
+    const detail::gap_buffer<char>* m_text;
+    std::size_t m_offset = 0;
     std::vector<detail::style_impl>::iterator m_out;
+    std::vector<detail::style_impl>::iterator m_first;
+    detail::style_window* m_written = nullptr;
 };
 
 } // namespace lined
\ No newline at end of file
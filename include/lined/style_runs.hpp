@@ -0,0 +1,293 @@
+#pragma once
+
+#include "style.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace lined::detail {
+
+using style_id = uint16_t;
+
+class style_palette
+{
+    static constexpr std::size_t max_styles = 0xffff;
+
+public:
+    // Styles are never removed one at a time, so a palette that grows past this is rebuilt from the styles still in
+    // use.
+    static constexpr std::size_t soft_limit = 4096;
+
+    style_palette() { clear(); }
+
+    style_id intern(const style_impl& s) {
+        auto it = m_ids.find(s.key());
+        if (it != m_ids.end()) {
+            return it->second;
+        } else if (m_styles.size() == max_styles) {
+            return 0;
+        }
+
+        auto id = static_cast<style_id>(m_styles.size());
+        m_styles.push_back(s);
+        m_ids.emplace(s.key(), id);
+        return id;
+    }
+
+    const style_impl& operator[](style_id id) const { return m_styles[id]; }
+
+    std::string_view transition(style_id from, style_id to) {
+        auto key = static_cast<uint32_t>(from) << 16 | to;
+        auto it = m_transitions.find(key);
+        if (it == m_transitions.end()) {
+            std::string sgr;
+            style_impl::append_transition(sgr, m_styles[from], m_styles[to]);
+            it = m_transitions.emplace(key, std::move(sgr)).first;
+        }
+
+        return it->second;
+    }
+
+    std::size_t size() const { return m_styles.size(); }
+
+    void clear() {
+        m_styles.clear();
+        m_ids.clear();
+        m_transitions.clear();
+        intern(style_impl{});
+    }
+
+private:
+    std::vector<style_impl> m_styles;
+    std::unordered_map<uint64_t, style_id> m_ids;
+    std::unordered_map<uint32_t, std::string> m_transitions;
+};
+
+struct style_run
+{
+    std::size_t length;
+    style_id style;
+};
+
+class style_runs
+{
+public:
+    static constexpr std::size_t npos = -1;
+
+    style_runs() {}
+
+    style_runs(std::size_t n, style_id s) { push_back(s, n); }
+
+    std::size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    const auto& runs() const { return m_runs; }
+
+    style_id operator[](std::size_t i) const { return m_runs[find(i).first].style; }
+
+    void push_back(style_id s, std::size_t n = 1) {
+        if (n == 0) {
+            return;
+        }
+
+        if (!m_runs.empty() && m_runs.back().style == s) {
+            m_runs.back().length += n;
+        } else {
+            m_runs.push_back({n, s});
+        }
+        m_size += n;
+    }
+
+    void append(const style_runs& other) {
+        for (const auto& r : other.m_runs) {
+            push_back(r.style, r.length);
+        }
+    }
+
+    // Interns styles a run of equal styles at a time.
+    void assign(const style_impl* styles, std::size_t n, style_palette& palette) {
+        clear();
+        for (std::size_t i = 0; i < n;) {
+            auto j = i + 1;
+            while (j < n && styles[j] == styles[i]) {
+                j++;
+            }
+            push_back(palette.intern(styles[i]), j - i);
+            i = j;
+        }
+    }
+
+    template <typename F>
+    void map(F&& f) {
+        for (auto& r : m_runs) {
+            r.style = f(r.style);
+        }
+    }
+
+    void clear() {
+        m_runs.clear();
+        m_size = 0;
+    }
+
+    void insert(std::size_t i, std::size_t n) {
+        if (m_runs.empty()) {
+            push_back(0, n);
+            return;
+        }
+
+        m_runs[i > 0 ? find(i - 1).first : 0].length += n;
+        m_size += n;
+    }
+
+    void insert(std::size_t i, std::size_t n, style_id s) {
+        if (n == 0) {
+            return;
+        }
+
+        auto [r, offset] = find(i);
+        if (r == m_runs.size()) {
+            push_back(s, n);
+            return;
+        }
+
+        m_size += n;
+        if (m_runs[r].style == s) {
+            m_runs[r].length += n;
+        } else if (offset == 0 && r > 0 && m_runs[r - 1].style == s) {
+            m_runs[r - 1].length += n;
+        } else if (offset == 0) {
+            m_runs.insert(m_runs.begin() + r, {n, s});
+        } else {
+            style_run tail{m_runs[r].length - offset, m_runs[r].style};
+            m_runs[r].length = offset;
+            m_runs.insert(m_runs.begin() + r + 1, {{n, s}, tail});
+        }
+    }
+
+    void erase(std::size_t begin, std::size_t end) {
+        if (begin >= end) {
+            return;
+        }
+
+        auto [r, offset] = find(begin);
+        auto n = end - begin;
+        m_size -= n;
+        if (offset > 0) {
+            auto erased = std::min(n, m_runs[r].length - offset);
+            m_runs[r].length -= erased;
+            n -= erased;
+            r++;
+        }
+
+        auto last = r;
+        while (n > 0 && n >= m_runs[last].length) {
+            n -= m_runs[last].length;
+            last++;
+        }
+        if (n > 0) {
+            m_runs[last].length -= n;
+        }
+        m_runs.erase(m_runs.begin() + r, m_runs.begin() + last);
+
+        if (r > 0 && r < m_runs.size() && m_runs[r - 1].style == m_runs[r].style) {
+            m_runs[r - 1].length += m_runs[r].length;
+            m_runs.erase(m_runs.begin() + r);
+        }
+    }
+
+    void replace(std::size_t i, style_id s) {
+        if ((*this)[i] != s) {
+            erase(i, i + 1);
+            insert(i, 1, s);
+        }
+    }
+
+    // Sets the styles of [begin, begin + n) and returns the first position whose style changed, or npos. Only the
+    // styles from there on are interned.
+    std::size_t overwrite(std::size_t begin, const style_impl* styles, std::size_t n, style_palette& palette) {
+        auto first = npos;
+        for_each_run(begin, begin + n, [&](auto b, auto e, style_id s) {
+            const auto& current = palette[s];
+            for (auto i = b; i < e && first == npos; ++i) {
+                if (styles[i - begin] != current) {
+                    first = i;
+                }
+            }
+        });
+        if (first == npos) {
+            return npos;
+        }
+
+        auto end = begin + n;
+        erase(first, end);
+        for (auto i = first; i < end;) {
+            auto j = i + 1;
+            while (j < end && styles[j - begin] == styles[i - begin]) {
+                j++;
+            }
+            insert(i, j - i, palette.intern(styles[i - begin]));
+            i = j;
+        }
+
+        return first;
+    }
+
+    template <typename F>
+    void for_each_run(std::size_t begin, std::size_t end, F&& f) const {
+        auto [r, offset] = find(begin);
+        while (begin < end) {
+            auto n = std::min(end - begin, m_runs[r].length - offset);
+            f(begin, begin + n, m_runs[r].style);
+            begin += n;
+            offset = 0;
+            r++;
+        }
+    }
+
+    std::size_t first_difference(const style_runs& other) const {
+        std::size_t pos = 0;
+        std::size_t a = 0;
+        std::size_t b = 0;
+        std::size_t a_used = 0;
+        std::size_t b_used = 0;
+        while (a < m_runs.size() && b < other.m_runs.size()) {
+            if (m_runs[a].style != other.m_runs[b].style) {
+                return pos;
+            }
+
+            auto n = std::min(m_runs[a].length - a_used, other.m_runs[b].length - b_used);
+            pos += n;
+            a_used += n;
+            b_used += n;
+            if (a_used == m_runs[a].length) {
+                a++;
+                a_used = 0;
+            }
+            if (b_used == other.m_runs[b].length) {
+                b++;
+                b_used = 0;
+            }
+        }
+
+        return m_size == other.m_size ? npos : pos;
+    }
+
+private:
+    std::pair<std::size_t, std::size_t> find(std::size_t i) const {
+        std::size_t r = 0;
+        while (r < m_runs.size() && i >= m_runs[r].length) {
+            i -= m_runs[r].length;
+            r++;
+        }
+
+        return {r, i};
+    }
+
+    std::vector<style_run> m_runs;
+    std::size_t m_size = 0;
+};
+
+} // namespace lined::detail
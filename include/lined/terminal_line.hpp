@@ -1,50 +1,89 @@
 #pragma once
 
-#include "fd.hpp"
+#include "output_buffer.hpp"
 #include "style.hpp"
+#include "style_runs.hpp"
 #include "terminal_string.hpp"
 #include "utf8.hpp"
 #include "wcwidth9.hpp"
+#include "width_profile.hpp"
 #include <algorithm>
-#include <numeric>
-#include <sys/ioctl.h>
+#include <functional>
+#include <optional>
 #include <vector>
 
 namespace lined {
 
+// The bytes [begin, old_end) of the text the callbacks last saw were replaced by [begin, new_end) of the current text.
+struct text_edit
+{
+    std::size_t begin;
+    std::size_t old_end;
+    std::size_t new_end;
+};
+
+// The UTF-8 text of the line, read where it is stored: first() followed by second(), split where it was last edited.
+// Converting it to a std::string_view makes it contiguous, which after an edit in the middle of the line moves the
+// text after the edit.
+class text_view
+{
+public:
+    text_view(const detail::gap_buffer<char>& text) : m_text(&text) {}
+
+    std::size_t size() const { return m_text->size() - 1; }
+    bool empty() const { return size() == 0; }
+    char operator[](std::size_t i) const { return (*m_text)[i]; }
+
+    std::string_view first() const { return {m_text->address(0), std::min(m_text->gap_position(), size())}; }
+    std::string_view second() const {
+        auto n = std::min(m_text->gap_position(), size());
+        return {m_text->address(n), size() - n};
+    }
+
+    operator std::string_view() const { return {m_text->data(), size()}; }
+
+private:
+    const detail::gap_buffer<char>* m_text;
+};
+
 using hint_callback_t = std::string(std::string_view);
 using color_callback_t = void(std::string_view, style_iterator);
+using hint_edit_callback_t = std::string(text_view, text_edit);
+using color_edit_callback_t = void(text_view, text_edit, style_iterator);
 
 namespace detail {
 
-struct term_state
+struct screen_cell
 {
-    terminal_string buf;
+    char32_t ch;
+    width_t width;
+    style_id style;
+    int row;
     int column;
 };
 
 class terminal_line
 {
-public:
-    terminal_line(int fd, const terminal_string& prompt, const std::function<hint_callback_t>& hint_callback,
-                  const std::function<color_callback_t>& color_callback, bool masked, style hint_style) :
-        m_fd(fd),
-        m_prompt(prompt), m_hint_callback(hint_callback), m_color_callback(color_callback), m_masked(masked),
-        m_hint_style(hint_style) {
-
-        winsize ws;
-        if (ioctl(1, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0) {
-            m_columns = 79 - m_prompt.total_width();
-        } else {
-            m_columns = ws.ws_col - m_prompt.total_width() - 1;
-        }
+    static constexpr std::size_t clean = -1;
 
+public:
+    terminal_line(output_buffer& out, style_palette& palette, const width_profile& widths, int columns,
+                  terminal_string prompt, const std::function<hint_edit_callback_t>& hint_callback,
+                  const std::function<color_edit_callback_t>& color_callback, bool incremental_color, bool masked,
+                  style hint_style, bool soft_wrap = false) :
+        m_out(out), m_palette(palette), m_widths(widths),
+        m_prompt(std::move(prompt)), m_hint_callback(hint_callback), m_color_callback(color_callback),
+        m_incremental_color(incremental_color), m_masked(masked), m_hint_style(palette.intern(hint_style)),
+        m_soft_wrap(soft_wrap) {
+        m_prompt.set_width_profile(m_widths);
+        m_buf.set_width_profile(m_widths);
+        set_columns(columns);
         sync();
     }
 
     ~terminal_line() {
         if (!m_popped) {
-            m_fd.write("\r\x1b[2K");
+            erase_rows();
         }
     }
 
@@ -53,7 +92,7 @@ public:
             return;
         }
 
-        m_position--;
+        m_position = m_buf.prev_boundary(m_position);
         sync();
     }
 
@@ -62,7 +101,7 @@ public:
             return;
         }
 
-        m_position++;
+        m_position = m_buf.next_boundary(m_position);
         sync();
     }
 
@@ -77,8 +116,23 @@ public:
     }
 
     void insert_character(char32_t to_insert) {
+        mark_dirty(m_position);
+        auto edit = begin_edit(m_position, m_position);
+        m_buf.insert(m_position, to_insert);
+        end_edit(edit, m_position + 1);
+        m_position = m_buf.next_boundary(m_position);
+        modified_sync();
+    }
+
+    void insert_string(std::u32string_view to_insert) {
+        mark_dirty(m_position);
+        auto edit = begin_edit(m_position, m_position);
         m_buf.insert(m_position, to_insert);
-        m_position++;
+        end_edit(edit, m_position + to_insert.size());
+        m_position += to_insert.size();
+        if (!m_buf.is_boundary(m_position)) {
+            m_position = m_buf.next_boundary(m_position);
+        }
         modified_sync();
     }
 
@@ -87,8 +141,10 @@ public:
             return;
         }
 
-        m_buf.erase(m_position - 1, m_position);
-        m_position--;
+        auto begin = m_buf.prev_boundary(m_position);
+        mark_dirty(begin);
+        erase(begin, m_position);
+        m_position = begin;
         modified_sync();
     }
 
@@ -97,18 +153,21 @@ public:
             return;
         }
 
-        m_buf.erase(m_position, m_position + 1);
+        mark_dirty(m_position);
+        erase(m_position, m_buf.next_boundary(m_position));
         modified_sync();
     }
 
     void erase_line_backward() {
-        m_buf.erase(0, m_position);
+        mark_dirty(0);
+        erase(0, m_position);
         m_position = 0;
         modified_sync();
     }
 
     void erase_line_forward() {
-        m_buf.erase(m_position, m_buf.size());
+        mark_dirty(m_position);
+        erase(m_position, m_buf.size());
         modified_sync();
     }
 
@@ -118,11 +177,19 @@ public:
         }
 
         if (m_position == m_buf.size()) {
-            m_position--;
+            m_position = m_buf.prev_boundary(m_position);
+            if (m_position == 0) {
+                return;
+            }
         }
 
-        m_buf.swap(m_position, m_position - 1);
-        m_position++;
+        auto begin = m_buf.prev_boundary(m_position);
+        auto end = m_buf.next_boundary(m_position);
+        mark_dirty(begin);
+        auto edit = begin_edit(begin, end);
+        m_buf.rotate(begin, m_position, end);
+        end_edit(edit, end);
+        m_position = end;
         modified_sync();
     }
 
@@ -140,39 +207,57 @@ public:
         }
         int erase_start = i == 0 ? 0 : i + 1;
 
-        m_buf.erase(erase_start, m_position);
+        mark_dirty(erase_start);
+        erase(erase_start, m_position);
         m_position = erase_start;
         modified_sync();
     }
 
     void clear_screen() {
-        m_fd.write("\x1b[2J\x1b[1;1H");
+        m_out.write("\x1b[2J\x1b[1;1H");
         redraw();
     }
 
     std::string pop_line() {
+        if (m_callbacks_pending) {
+            run_callbacks();
+        }
+        flush_update();
         m_popped = true;
         m_hint.clear();
-        sync();
-        m_fd.write("\r\n");
+        m_hint_text.clear();
+        mark_dirty(m_buf.size());
+        sync_now();
+        move_below();
         return m_buf.to_string();
     }
 
     void new_line() {
-        m_fd.write("\r\n");
+        flush_update();
+        move_below();
         redraw();
     }
 
     void set_line(std::u32string_view str) {
         m_position = str.length();
+        auto edit = begin_edit(0, m_buf.size());
         m_buf = terminal_string(str);
+        end_edit(edit, m_buf.size());
+        m_buf.set_width_profile(m_widths);
+        mark_dirty(0);
         modified_sync();
     }
 
-    void erase_line_visual() { m_fd.write("\r\x1b[2K"); }
+    void erase_line_visual() {
+        flush_update();
+        erase_rows();
+    }
 
     void redraw() {
-        m_prev = {};
+        m_screen.clear();
+        m_cursor_row = 0;
+        m_cursor_column = 0;
+        m_rows = 1;
         sync();
     }
 
@@ -180,28 +265,330 @@ public:
 
     bool empty() const { return m_buf.empty(); }
 
+    void resize(int columns) {
+        flush_update();
+        set_columns(columns);
+        reflow();
+    }
+
+    void set_width_profile(const width_profile& widths) {
+        flush_update();
+        m_widths = widths;
+        m_prompt.set_width_profile(widths);
+        m_buf.set_width_profile(widths);
+        m_hint.set_width_profile(widths);
+        set_columns(m_terminal_columns);
+        reflow();
+    }
+
+    void begin_update() { m_deferred = true; }
+
+    void end_update() {
+        m_deferred = false;
+        flush_update();
+    }
+
+    void set_callbacks_deferred(bool deferred) { m_callbacks_deferred = deferred; }
+
+    bool callbacks_pending() const { return m_callbacks_pending; }
+
+    void run_deferred_callbacks() {
+        if (m_callbacks_pending) {
+            run_callbacks();
+            sync();
+        }
+    }
+
 private:
+    void set_columns(int columns) {
+        m_terminal_columns = std::max(columns, 1);
+        m_columns = std::max(columns - m_prompt.total_width() - 1, 1);
+    }
+
+    // Clears what is on screen and draws the line again from scratch, after a change to its geometry.
+    void reflow() {
+        if (m_soft_wrap) {
+            erase_rows();
+        } else {
+            m_out.write("\r\x1b[K");
+        }
+        redraw();
+    }
+
+    void flush_update() {
+        if (m_callbacks_pending && !m_callbacks_deferred) {
+            run_callbacks();
+        }
+        if (m_sync_pending) {
+            sync_now();
+        }
+    }
+
+    void erase(std::size_t begin, std::size_t end) {
+        auto edit = begin_edit(begin, end);
+        m_buf.erase(begin, end);
+        end_edit(edit, begin);
+    }
+
+    // Records that the code points [begin, end) are about to be replaced, in bytes.
+    text_edit begin_edit(std::size_t begin, std::size_t end) const {
+        return {m_buf.byte_offset(begin), m_buf.byte_offset(end), 0};
+    }
+
+    // Completes an edit whose replacement ends at code point end, and merges it into the edits the callbacks have not
+    // seen yet.
+    void end_edit(text_edit edit, std::size_t end) {
+        edit.new_end = m_buf.byte_offset(end);
+        if (!m_edit) {
+            m_edit = edit;
+            return;
+        }
+
+        // Both ranges are in terms of the text between the two edits. Map the pending range's end through the new edit,
+        // and the new edit's old end back through the pending one.
+        auto& e = *m_edit;
+        auto new_end = e.new_end <= edit.begin ? e.new_end
+                     : e.new_end >= edit.old_end ? e.new_end - edit.old_end + edit.new_end
+                                                 : edit.new_end;
+        auto old_end = edit.old_end >= e.new_end ? edit.old_end - e.new_end + e.old_end : e.old_end;
+        e.begin = std::min(e.begin, edit.begin);
+        e.old_end = std::max(e.old_end, old_end);
+        e.new_end = std::max(new_end, edit.new_end);
+    }
+
     void modified_sync() {
-        if (!m_masked) {
+        m_callbacks_pending = true;
+        m_sync_pending = true;
+        if (!m_deferred) {
+            flush_update();
+        }
+    }
+
+    void run_callbacks() {
+        m_callbacks_pending = false;
+        m_sync_pending = true;
+        auto pending = m_edit;
+        m_edit.reset();
+        if (!m_masked && (m_hint_callback || m_color_callback)) {
+            text_view text(m_buf.utf8());
+            auto edit = pending.value_or(text_edit{text.size(), text.size(), text.size()});
             if (m_hint_callback) {
-                auto hint = m_hint_callback(m_buf.to_string());
-                m_hint = terminal_string(hint, m_hint_style);
+                auto hint = m_hint_callback(text, edit);
+                if (hint != m_hint_text) {
+                    m_hint_text = hint;
+                    m_hint = terminal_string(hint, m_hint_style);
+                    m_hint.set_width_profile(m_widths);
+                    mark_dirty(m_buf.size());
+                }
             }
 
-            if (m_color_callback) {
-                auto str = m_buf.to_string();
-                std::vector<style_impl> style_vec(m_buf.size());
-                style_iterator iter(str.data(), style_vec);
-                m_color_callback(str, iter);
-                m_buf.style() = std::move(style_vec);
+            if (m_color_callback && m_incremental_color) {
+                restyle(text, edit);
+            } else if (m_color_callback) {
+                m_style_scratch.assign(m_buf.size(), style_impl{});
+                style_iterator iter(m_buf.utf8(), m_style_scratch);
+                m_color_callback(text, edit, iter);
+                m_runs_scratch.assign(m_style_scratch.data(), m_style_scratch.size(), m_palette);
+                auto diff = m_runs_scratch.first_difference(m_buf.style());
+                if (diff != style_runs::npos) {
+                    mark_dirty(diff);
+                    m_buf.swap_style(m_runs_scratch);
+                }
+            }
+
+            if (m_palette.size() > m_palette_limit) {
+                rebuild_palette();
             }
         }
+    }
 
-        sync();
+    // Renumbers every style that is still in use, on the screen or in the strings, into a new palette and drops the
+    // rest. The next rebuild waits until the palette has doubled, so a line with many live styles does not rebuild on
+    // every change.
+    void rebuild_palette() {
+        constexpr style_id unmapped = -1;
+        style_palette live;
+        std::vector<style_id> ids(m_palette.size(), unmapped);
+        auto map = [&](style_id id) {
+            if (ids[id] == unmapped) {
+                ids[id] = live.intern(m_palette[id]);
+            }
+            return ids[id];
+        };
+
+        m_prompt.map_styles(map);
+        m_buf.map_styles(map);
+        m_hint.map_styles(map);
+        for (auto& cell : m_screen) {
+            cell.style = map(cell.style);
+        }
+        m_current_style = map(m_current_style);
+        m_hint_style = map(m_hint_style);
+        m_palette = std::move(live);
+        m_palette_limit = std::max(style_palette::soft_limit, 2 * m_palette.size());
+    }
+
+    // Hands the callback an iterator at the start of the edit. Only the styles it writes are applied, so the cost
+    // follows what it restyles rather than the length of the line.
+    void restyle(text_view text, text_edit edit) {
+        auto& window = m_style_window;
+        m_style_scratch.resize(m_buf.size());
+        window.written.resize(m_buf.size());
+        window.begin = -1;
+        window.end = 0;
+        style_iterator iter(m_buf.utf8(), edit.begin, m_style_scratch, m_buf.index_of_byte(edit.begin), window);
+        m_color_callback(text, edit, iter);
+        if (window.begin >= window.end) {
+            return;
+        }
+
+        // Positions inside the window that the callback skipped keep the style they already have
+        m_buf.style().for_each_run(window.begin, window.end, [&](auto b, auto e, const auto& s) {
+            for (auto i = b; i < e; ++i) {
+                if (!window.written[i]) {
+                    m_style_scratch[i] = m_palette[s];
+                }
+                window.written[i] = 0;
+            }
+        });
+
+        auto diff = m_buf.restyle(window.begin, m_style_scratch.data() + window.begin, window.end - window.begin,
+                                  m_palette);
+        if (diff != style_runs::npos) {
+            mark_dirty(diff);
+        }
     }
 
     void sync() {
-        auto state = current_state();
+        if (m_deferred) {
+            m_sync_pending = true;
+            return;
+        }
+
+        sync_now();
+    }
+
+    void sync_now() {
+        m_sync_pending = false;
+
+        std::size_t n_prompt = m_prompt.size();
+        std::size_t d = m_screen.size();
+        bool dirty = m_dirty != clean;
+        if (m_screen.empty() || dirty || m_position < m_view_start || m_position > m_view_end) {
+            update_view();
+            if (m_screen.empty()) {
+                d = 0;
+            } else if (m_view_start != m_screen_view_start) {
+                d = n_prompt;
+            } else {
+                auto first = std::min({m_dirty, m_view_end, m_screen_view_end});
+                if (first < m_buf.size() && !m_buf.is_boundary(first)) {
+                    first = m_buf.prev_boundary(first);
+                }
+                if (first != clean) {
+                    d = n_prompt + (first > m_view_start ? first - m_view_start : 0);
+                }
+            }
+        }
+
+        // A dirty position at the end of the buffer leaves d at the end of the screen but may still change the hint.
+        if (m_screen.empty() || dirty || d < m_screen.size() || m_view_end != m_screen_view_end) {
+            build_cells(d);
+            if (m_soft_wrap) {
+                draw_rows(d);
+            } else {
+                draw_cells(d);
+            }
+        }
+
+        m_dirty = clean;
+        m_screen_view_start = m_view_start;
+        m_screen_view_end = m_view_end;
+
+        auto i = n_prompt + m_position - m_view_start;
+        if (m_soft_wrap) {
+            auto [row, column] = i < m_screen.size() ? std::pair{m_screen[i].row, m_screen[i].column} : end_slot();
+            move_to(row, column);
+        } else {
+            move_cursor_to(i < m_screen.size() ? m_screen[i].column : screen_width(), m_cursor_column);
+        }
+    }
+
+    void update_view() {
+        if (m_soft_wrap) {
+            m_view_start = 0;
+            m_view_end = m_buf.size();
+            return;
+        }
+
+        if (m_position < m_view_start) {
+            m_view_start = m_position;
+        }
+
+        auto [fwd_end, fwd_width] = iterate_view_forward(m_view_start, m_columns);
+        if (m_position > fwd_end) {
+            auto [start, bkwd_width] = iterate_view_backward(m_position, m_columns);
+            m_view_start = start;
+            m_view_end = m_position;
+            m_view_width = bkwd_width;
+        } else {
+            auto [start, bkwd_width] = iterate_view_backward(m_view_start, m_columns - fwd_width);
+            m_view_start = start;
+            m_view_end = fwd_end;
+            m_view_width = fwd_width + bkwd_width;
+        }
+    }
+
+    void build_cells(std::size_t d) {
+        m_next.clear();
+        int row = d > 0 ? m_screen[d - 1].row : 0;
+        int column = d > 0 ? m_screen[d - 1].column + m_screen[d - 1].width : 0;
+
+        auto push = [&](char32_t c, width_t w, style_id s) {
+            if (m_soft_wrap && w > 0 && column + w > m_terminal_columns && column > 0) {
+                row++;
+                column = 0;
+            }
+            m_next.push_back({c, w, s, row, column});
+            column += w;
+        };
+
+        auto push_range = [&](const terminal_string& str, std::size_t begin, std::size_t end) {
+            str.style().for_each_run(begin, end, [&](std::size_t run_begin, std::size_t run_end, style_id s) {
+                for (auto i = run_begin; i < run_end; ++i) {
+                    push(str[i], str.width()[i], s);
+                }
+            });
+        };
+
+        if (d < m_prompt.size()) {
+            push_range(m_prompt, d, m_prompt.size());
+        }
+
+        auto first = m_view_start + (d > m_prompt.size() ? d - m_prompt.size() : 0);
+        if (m_masked) {
+            for (auto i = first; i < m_view_end; ++i) {
+                push('*', 1, 0);
+            }
+        } else {
+            push_range(m_buf, first, m_view_end);
+        }
+
+        if (m_view_end == m_buf.size()) {
+            std::size_t hint_end = 0;
+            int hint_width = m_view_width;
+            while (hint_end < m_hint.size() && (m_soft_wrap || hint_width + m_hint.width()[hint_end] <= m_columns)) {
+                hint_width += m_hint.width()[hint_end];
+                hint_end++;
+            }
+            push_range(m_hint, 0, hint_end);
+        }
+    }
+
+    void draw_cells(std::size_t d) {
+        const auto* prev = m_screen.data() + d;
+        std::size_t n_prev = m_screen.size() - d;
+        int base_col = d < m_screen.size() ? m_screen[d].column : screen_width();
 
         std::size_t i = 0;
         std::size_t i_col = 0;
@@ -212,162 +599,293 @@ private:
         std::size_t start_update = i;
         std::size_t end_update = -1UL;
         bool first = true;
-        while (i < state.buf.size() && j < m_prev.buf.size()) {
+        while (i < m_next.size() && j < n_prev) {
+            auto i_end = cluster_end(m_next.data(), m_next.size(), i);
+            auto j_end = cluster_end(prev, n_prev, j);
             if (i_col == j_col) {
-                if (state.buf[i] != m_prev.buf[j] || state.buf.style()[i] != m_prev.buf.style()[j]) {
+                if (!std::equal(m_next.begin() + i, m_next.begin() + i_end, prev + j, prev + j_end, same_glyph)) {
                     if (first) {
                         first = false;
                         start_update = i;
                         start_col = i_col;
                     }
-                    end_update = i;
-                    end_col = i_col + state.buf.width()[i];
+                    end_update = i_end - 1;
+                    end_col = i_col + m_next[i].width;
                 }
-                i_col += state.buf.width()[i];
-                j_col += m_prev.buf.width()[j];
-                i++;
-                j++;
+                i_col += m_next[i].width;
+                j_col += prev[j].width;
+                i = i_end;
+                j = j_end;
             } else {
                 if (i_col > j_col) {
-                    j_col += m_prev.buf.width()[j];
-                    j++;
+                    j_col += prev[j].width;
+                    j = j_end;
                 } else {
-                    end_update = i;
-                    end_col = i_col + state.buf.width()[i];
-                    i_col += state.buf.width()[i];
-                    i++;
+                    end_update = i_end - 1;
+                    end_col = i_col + m_next[i].width;
+                    i_col += m_next[i].width;
+                    i = i_end;
                 }
             }
         }
 
-        if (i < state.buf.size()) {
-            end_update = state.buf.size() - 1;
-            end_col = state.buf.total_width();
+        if (i < m_next.size()) {
+            end_update = m_next.size() - 1;
+            end_col = m_next.back().column + m_next.back().width - base_col;
         }
 
-        int current_column = m_prev.column;
-
         if (end_update != -1UL) {
-            move_cursor_to(start_col, current_column);
-            auto to_write = std::u32string_view(state.buf.buf()).substr(start_update, end_update - start_update + 1);
-            auto style_it = state.buf.style().begin() + start_update;
-            auto style_end = state.buf.style().begin() + end_update + 1;
-
-            while (!to_write.empty()) {
-                auto new_style = std::find_if(style_it, style_end, [this](auto s) { return s != m_current_style; });
-                auto n = std::distance(style_it, new_style);
-                m_fd.write(to_write.substr(0, n));
-                to_write = to_write.substr(n);
-
-                if (new_style != style_end) {
-                    m_fd.write(style_impl::switch_to(m_current_style, *new_style));
-                    style_it = new_style;
+            move_cursor_to(base_col + start_col, m_cursor_column);
+            for (auto k = start_update; k <= end_update; ++k) {
+                switch_style(m_next[k].style);
+                m_out.write(m_next[k].ch);
+            }
+
+            m_cursor_column = base_col + end_col;
+            switch_style(0);
+        }
+
+        if (j < n_prev) {
+            move_cursor_to(m_next.empty() ? base_col : m_next.back().column + m_next.back().width, m_cursor_column);
+            m_out.write("\x1b[K");
+        }
+
+        m_screen.resize(d);
+        m_screen.insert(m_screen.end(), m_next.begin(), m_next.end());
+    }
+
+    void draw_rows(std::size_t d) {
+        std::size_t i = d;
+        std::size_t j = 0;
+        int last_row = m_next.empty() ? (d > 0 ? m_screen[d - 1].row : 0) : m_next.back().row;
+        int row = j < m_next.size() ? m_next[j].row : last_row;
+        if (i < m_screen.size()) {
+            row = std::min(row, m_screen[i].row);
+        }
+
+        for (; row <= last_row; ++row) {
+            auto i_end = i;
+            while (i_end < m_screen.size() && m_screen[i_end].row == row) {
+                i_end++;
+            }
+            auto j_end = j;
+            while (j_end < m_next.size() && m_next[j_end].row == row) {
+                j_end++;
+            }
+
+            auto [old_diff, new_diff] = std::mismatch(m_screen.begin() + i, m_screen.begin() + i_end,
+                                                      m_next.begin() + j, m_next.begin() + j_end, same_cell);
+            if (old_diff != m_screen.begin() + i_end || new_diff != m_next.begin() + j_end) {
+                int row_start = 0;
+                if (d > 0 && m_screen[d - 1].row == row) {
+                    row_start = m_screen[d - 1].column + m_screen[d - 1].width;
+                }
+                int old_end = i_end > i ? m_screen[i_end - 1].column + m_screen[i_end - 1].width : row_start;
+                int new_end = j_end > j ? m_next[j_end - 1].column + m_next[j_end - 1].width : row_start;
+
+                // A difference in a continuation changes the whole cluster, so redraw it from its first cell. The
+                // cells before the mismatch are the same on both sides.
+                bool old_continuation = old_diff != m_screen.begin() + i_end && old_diff->width == 0;
+                bool new_continuation = new_diff != m_next.begin() + j_end && new_diff->width == 0;
+                if (old_continuation || new_continuation) {
+                    while (new_diff != m_next.begin() + j) {
+                        if ((--new_diff)->width != 0) {
+                            break;
+                        }
+                    }
+                }
+
+                if (new_diff != m_next.begin() + j_end) {
+                    move_to(row, new_diff->column);
+                    for (auto it = new_diff; it != m_next.begin() + j_end; ++it) {
+                        switch_style(it->style);
+                        m_out.write(it->ch);
+                    }
+                    m_cursor_column = new_end;
+                    switch_style(0);
+                }
+
+                if (old_end > new_end) {
+                    move_to(row, new_end);
+                    m_out.write("\x1b[K");
                 }
             }
 
-            current_column = end_col;
-            m_fd.write(style_impl::switch_to(m_current_style, style{}));
+            i = i_end;
+            j = j_end;
         }
 
-        if (j < m_prev.buf.size()) {
-            move_cursor_to(state.buf.total_width(), current_column);
-            m_fd.write("\x1b[K");
+        if (i < m_screen.size()) {
+            move_to(last_row + 1, 0);
+            m_out.write("\x1b[J");
+            m_rows = last_row + 1;
         }
 
-        move_cursor_to(state.column, current_column);
+        m_screen.resize(d);
+        m_screen.insert(m_screen.end(), m_next.begin(), m_next.end());
+    }
+
+    // The end of the cluster starting at cells[i]: the cell itself and the zero-width cells drawn on top of it.
+    static std::size_t cluster_end(const screen_cell* cells, std::size_t n, std::size_t i) {
+        do {
+            i++;
+        } while (i < n && cells[i].width == 0);
 
-        m_prev = std::move(state);
+        return i;
     }
 
-    void move_cursor_to(int column, int& prev) {
-        int n = column - prev;
-        prev = column;
+    static bool same_glyph(const screen_cell& a, const screen_cell& b) { return a.ch == b.ch && a.style == b.style; }
+
+    static bool same_cell(const screen_cell& a, const screen_cell& b) {
+        return a.ch == b.ch && a.style == b.style && a.column == b.column && a.width == b.width;
+    }
+
+    std::pair<int, int> end_slot() const {
+        if (m_screen.empty()) {
+            return {0, 0};
+        }
+
+        auto end = m_screen.back().column + m_screen.back().width;
+        if (end + 1 > m_terminal_columns) {
+            return {m_screen.back().row + 1, 0};
+        }
+
+        return {m_screen.back().row, end};
+    }
+
+    void move_rows(int n) {
         if (n > 0) {
-            m_fd.write("\x1b[" + std::to_string(n) + "C");
+            m_out.write_csi(n, 'B');
         } else if (n < 0) {
-            m_fd.write("\x1b[" + std::to_string(-n) + "D");
+            m_out.write_csi(-n, 'A');
         }
     }
 
-    term_state current_state() {
-        std::vector<width_t> mask_width;
-        if (m_masked) {
-            mask_width = std::vector<width_t>(m_buf.size(), 1);
+    void move_to(int row, int column) {
+        if (row >= m_rows) {
+            move_rows(m_rows - 1 - m_cursor_row);
+            for (; m_rows <= row; ++m_rows) {
+                m_out.write("\r\n");
+            }
+            m_cursor_column = 0;
+        } else {
+            move_rows(row - m_cursor_row);
         }
-        const auto& width = m_masked ? mask_width : m_buf.width();
+        m_cursor_row = row;
 
-        if (m_position < m_view_start) {
-            m_view_start = m_position;
+        if (column != m_cursor_column) {
+            if (column == 0) {
+                m_out.write('\r');
+            } else {
+                m_out.write_csi(column + 1, 'G');
+            }
+            m_cursor_column = column;
         }
+    }
 
-        auto [fwd_end, fwd_width] = iterate_view_forward(m_view_start, m_columns, width);
-        std::size_t end;
-        int total_width;
-        if (m_position > fwd_end) {
-            auto [start, bkwd_width] = iterate_view_backward(m_position, m_columns, width);
-            m_view_start = start;
-            end = m_position;
-            total_width = bkwd_width;
-        } else {
-            auto [start, bkwd_width] = iterate_view_backward(m_view_start, m_columns - fwd_width, width);
-            m_view_start = start;
-            end = fwd_end;
-            total_width = fwd_width + bkwd_width;
+    void move_below() {
+        if (m_soft_wrap) {
+            move_rows((m_screen.empty() ? 0 : m_screen.back().row) - m_cursor_row);
         }
+        m_out.write("\r\n");
+        m_cursor_row = 0;
+        m_cursor_column = 0;
+        m_rows = 1;
+    }
 
-        int column = std::accumulate(width.begin() + m_view_start, width.begin() + m_position, m_prompt.total_width());
-        auto view = m_prompt;
-        view += m_masked ? terminal_string(std::string(m_buf.size(), '*')) : m_buf.substr(m_view_start, end);
+    void erase_rows() {
+        if (m_soft_wrap) {
+            move_rows(-m_cursor_row);
+            m_out.write("\r\x1b[J");
+        } else {
+            m_out.write("\r\x1b[2K");
+        }
+        m_cursor_row = 0;
+        m_cursor_column = 0;
+    }
 
-        if (end == m_buf.size()) {
-            auto [hint_view_end, hint_view_width] = iterate_view_forward(0, m_columns - total_width, m_hint.width());
-            if (hint_view_end > 0) {
-                view += m_hint.substr(0, hint_view_end);
-                total_width += hint_view_width;
-            }
+    void switch_style(style_id id) {
+        if (id != m_current_style) {
+            m_out.write(m_palette.transition(m_current_style, id));
+            m_current_style = id;
         }
+    }
+
+    int screen_width() const { return m_screen.empty() ? 0 : m_screen.back().column + m_screen.back().width; }
 
-        return {std::move(view), column};
+    void mark_dirty(std::size_t i) { m_dirty = std::min(m_dirty, i); }
+
+    void move_cursor_to(int column, int& prev) {
+        int n = column - prev;
+        prev = column;
+        if (n > 0) {
+            m_out.write_csi(n, 'C');
+        } else if (n < 0) {
+            m_out.write_csi(-n, 'D');
+        }
     }
 
-    std::pair<std::size_t, int> iterate_view_forward(int start, int max_width,
-                                                     const std::vector<width_t>& width) const {
-        std::size_t i = start;
-        int w = 0;
-        while (i < width.size() && w + width[i] <= max_width) {
-            w += width[i];
-            i++;
+    std::pair<std::size_t, int> iterate_view_forward(std::size_t start, int max_width) const {
+        if (m_masked) {
+            auto end = std::min(m_buf.size(), start + max_width);
+            return {end, static_cast<int>(end - start)};
         }
 
-        return {i, w};
+        auto end = m_buf.width().forward(start, max_width);
+        return {end, m_buf.width().sum(start, end)};
     }
 
-    std::pair<std::size_t, int> iterate_view_backward(int start, int max_width,
-                                                      const std::vector<width_t>& width) const {
-        int i = start;
-        int w = 0;
-        while (i >= 1 && w + width[i - 1] <= max_width) {
-            w += width[i - 1];
-            i--;
+    std::pair<std::size_t, int> iterate_view_backward(std::size_t start, int max_width) const {
+        if (m_masked) {
+            auto begin = start - std::min(start, static_cast<std::size_t>(max_width));
+            return {begin, static_cast<int>(start - begin)};
         }
 
-        return {i, w};
+        auto begin = m_buf.width().backward(start, max_width);
+        if (!m_buf.is_boundary(begin)) {
+            begin = m_buf.next_boundary(begin);
+        }
+        return {begin, m_buf.width().sum(begin, start)};
     }
 
-    output_fd m_fd;
+    output_buffer& m_out;
+    style_palette& m_palette;
+    std::size_t m_palette_limit = style_palette::soft_limit;
+    width_profile m_widths;
     int m_columns;
     terminal_string m_prompt;
     terminal_string m_buf;
-    std::function<hint_callback_t> m_hint_callback;
+    std::function<hint_edit_callback_t> m_hint_callback;
     terminal_string m_hint;
-    std::function<color_callback_t> m_color_callback;
+    std::string m_hint_text;
+    std::function<color_edit_callback_t> m_color_callback;
+    bool m_incremental_color;
     std::size_t m_position = 0;
     std::size_t m_view_start = 0;
-    term_state m_prev = {};
-    style_impl m_current_style = style{};
+    std::size_t m_view_end = 0;
+    int m_view_width = 0;
+    std::vector<screen_cell> m_screen;
+    std::vector<screen_cell> m_next;
+    std::optional<text_edit> m_edit;
+    std::vector<style_impl> m_style_scratch;
+    style_window m_style_window;
+    style_runs m_runs_scratch;
+    std::size_t m_screen_view_start = 0;
+    std::size_t m_screen_view_end = 0;
+    std::size_t m_dirty = clean;
+    int m_cursor_row = 0;
+    int m_cursor_column = 0;
+    int m_rows = 1;
+    int m_terminal_columns;
+    style_id m_current_style = 0;
     bool m_popped = false;
+    bool m_deferred = false;
+    bool m_sync_pending = false;
+    bool m_callbacks_deferred = false;
+    bool m_callbacks_pending = false;
     bool m_masked;
-    style m_hint_style;
+    style_id m_hint_style;
+    bool m_soft_wrap;
 };
 
 } // namespace detail
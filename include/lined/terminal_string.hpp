@@ -1,106 +1,268 @@
 #pragma once
 
+#include "gap_buffer.hpp"
+#include "grapheme.hpp"
 #include "style.hpp"
-#include "wcwidth9.hpp"
-#include <numeric>
+#include "style_runs.hpp"
+#include "utf8.hpp"
+#include "width_buffer.hpp"
+#include "width_profile.hpp"
+#include <algorithm>
+#include <string>
 #include <string_view>
 #include <vector>
 
 namespace lined::detail {
 
-using width_t = int8_t;
-
 class terminal_string
 {
 public:
-    terminal_string() : m_total_width(0) {};
+    terminal_string() {};
 
-    terminal_string(std::string_view str, style default_style = {}) :
-        terminal_string(decode_utf8(str), default_style) {}
+    terminal_string(std::string_view str, style_id default_style = 0) : terminal_string(decode_utf8(str), default_style) {}
 
-    terminal_string(std::u32string_view str, style default_style = {}) {
-        m_buf = str;
-        m_total_width = 0;
-        m_width.reserve(str.size());
+    terminal_string(std::u32string_view str, style_id default_style = 0) {
+        std::vector<width_t> width;
+        std::vector<uint8_t> cluster_start;
+        std::vector<width_t> bytes;
+        width.reserve(str.size());
+        cluster_start.reserve(str.size());
+        bytes.reserve(str.size());
+        grapheme_segmenter segmenter;
         for (auto wc : str) {
-            auto w = wcwidth9_norm(wc);
-            m_width.push_back(w);
-            m_total_width += w;
+            auto boundary = segmenter.next(wc);
+            width.push_back(boundary ? m_widths.width(wc) : 0);
+            cluster_start.push_back(boundary);
+            bytes.push_back(utf8_length(wc));
         }
-        m_style = std::vector<style_impl>(str.size(), default_style);
+        m_buf = std::vector<char32_t>(str.begin(), str.end());
+        m_width = std::move(width);
+        m_cluster_start = std::move(cluster_start);
+        m_style = style_runs(str.size(), default_style);
+        m_bytes = std::move(bytes);
+        std::string text;
+        text.reserve(str.size());
+        encode_utf8(str, text);
+        m_text = std::vector<char>(text.c_str(), text.c_str() + text.size() + 1);
     }
 
     const char32_t& operator[](std::size_t i) const { return m_buf[i]; }
 
     terminal_string operator+(const terminal_string& other) const {
-        terminal_string result;
-        result.m_buf = m_buf + other.m_buf;
-        result.m_width = m_width;
-        result.m_width.insert(result.m_width.end(), other.m_width.begin(), other.m_width.end());
-        result.m_style.insert(result.m_style.end(), other.m_style.begin(), other.m_style.end());
-        result.m_total_width = m_total_width + other.m_total_width;
+        auto result = *this;
+        result += other;
         return result;
     }
 
     terminal_string& operator+=(const terminal_string& other) {
-        m_buf.insert(m_buf.end(), other.m_buf.begin(), other.m_buf.end());
-        m_width.insert(m_width.end(), other.m_width.begin(), other.m_width.end());
-        m_style.insert(m_style.end(), other.m_style.begin(), other.m_style.end());
-        m_total_width += other.m_total_width;
+        auto begin = size();
+        for (std::size_t i = 0; i < other.size(); ++i) {
+            m_buf.push_back(other.m_buf[i]);
+            m_width.push_back(other.m_width[i]);
+            m_cluster_start.push_back(other.m_cluster_start[i]);
+            m_bytes.push_back(other.m_bytes[i]);
+        }
+        m_style.append(other.m_style);
+        auto text = other.m_text.slice(0, other.m_text.size() - 1);
+        m_text.insert(m_text.size() - 1, text.begin(), text.end());
+        if (other.m_widths != m_widths) {
+            measure(begin, size());
+        }
+        segment(begin, begin);
         return *this;
     }
 
-    const auto& buf() const { return m_buf; }
+    std::u32string_view buf() const { return {m_buf.data(), m_buf.size()}; }
     const auto& width() const { return m_width; }
-    auto& style() { return m_style; }
-    auto total_width() const { return m_total_width; }
-    std::string to_string() const { return encode_utf8(m_buf); }
+    const auto& style() const { return m_style; }
+    void swap_style(style_runs& style) { std::swap(m_style, style); }
+    std::size_t restyle(std::size_t begin, const style_impl* styles, std::size_t n, style_palette& palette) {
+        return m_style.overwrite(begin, styles, n, palette);
+    }
+    // Renumbers the styles, for a string moving to another palette or a palette being rebuilt.
+    template <typename F>
+    void map_styles(F&& f) {
+        m_style.map(f);
+    }
+    int total_width() const { return m_width.total(); }
+    std::string to_string() const { return std::string(text()); }
+    // The UTF-8 encoding of buf(), kept up to date by every edit and followed by a null. text() makes it contiguous,
+    // which moves the gap in m_text to the end, so edits only pay for that when something reads it that way.
+    std::string_view text() const { return {m_text.data(), m_text.size() - 1}; }
+    const gap_buffer<char>& utf8() const { return m_text; }
+    std::size_t byte_offset(std::size_t i) const { return m_bytes.sum(0, i); }
+    std::size_t index_of_byte(std::size_t offset) const { return m_bytes.forward(0, offset); }
     std::size_t size() const { return m_buf.size(); }
     bool empty() const { return m_buf.empty(); }
 
+    bool is_boundary(std::size_t i) const { return i >= size() || m_cluster_start[i]; }
+
+    std::size_t next_boundary(std::size_t i) const {
+        do {
+            i++;
+        } while (i < size() && !m_cluster_start[i]);
+
+        return std::min(i, size());
+    }
+
+    std::size_t prev_boundary(std::size_t i) const {
+        if (i == 0) {
+            return 0;
+        }
+
+        do {
+            i--;
+        } while (i > 0 && !m_cluster_start[i]);
+
+        return i;
+    }
+
     void clear() {
         m_buf.clear();
         m_width.clear();
+        m_cluster_start.clear();
         m_style.clear();
+        m_bytes.clear();
+        m_text.erase(0, m_text.size() - 1);
     }
 
     terminal_string substr(std::size_t begin, std::size_t end) const {
         terminal_string sub;
-        sub.m_buf = m_buf.substr(begin, end - begin);
-        sub.m_width = std::vector<width_t>(m_width.begin() + begin, m_width.begin() + end);
-        sub.m_style = std::vector<style_impl>(m_style.begin() + begin, m_style.begin() + end);
-        sub.m_total_width = std::accumulate(sub.m_width.begin(), sub.m_width.end(), 0);
+        sub.m_widths = m_widths;
+        sub.m_buf = m_buf.slice(begin, end);
+        sub.m_width = m_width.slice(begin, end);
+        sub.m_cluster_start = m_cluster_start.slice(begin, end);
+        sub.m_bytes = m_bytes.slice(begin, end);
+        auto text = m_text.slice(byte_offset(begin), byte_offset(end));
+        text.push_back('\0');
+        sub.m_text = std::move(text);
+        m_style.for_each_run(begin, end, [&](auto b, auto e, const auto& s) { sub.m_style.push_back(s, e - b); });
+        sub.segment(0, 0);
         return sub;
     }
 
     void insert(std::size_t i, char32_t c) {
-        m_buf.insert(m_buf.begin() + i, c);
+        m_buf.insert(i, c);
+        m_width.insert(i, 0);
+        m_cluster_start.insert(i, 1);
+        m_style.insert(i, 1);
+        insert_text(i, {&c, 1});
+        segment(i, i + 1);
+    }
 
-        auto w = wcwidth9_norm(c);
-        m_width.insert(m_width.begin() + i, w);
-        m_style.insert(m_style.begin() + i, style_impl{});
-        m_total_width += w;
+    void insert(std::size_t i, std::u32string_view str) {
+        if (str.size() > 1 && printable_ascii(str)) {
+            insert_ascii(i, str);
+            return;
+        }
+
+        m_buf.insert(i, str.begin(), str.end());
+        m_width.insert(i, str.size(), 0);
+        m_cluster_start.insert(i, str.size(), 1);
+        m_style.insert(i, str.size());
+        insert_text(i, str);
+        segment(i, i + str.size());
+    }
+
+    void insert(std::size_t i, const terminal_string& str) {
+        for (std::size_t j = 0; j < str.size(); ++j) {
+            m_buf.insert(i + j, str.m_buf[j]);
+            m_width.insert(i + j, 0);
+            m_cluster_start.insert(i + j, 1);
+        }
+        insert_text(i, str.buf());
+        str.m_style.for_each_run(0, str.size(), [&](auto b, auto e, const auto& s) { m_style.insert(i + b, e - b, s); });
+        segment(i, i + str.size());
     }
 
     void erase(std::size_t begin, std::size_t end) {
-        auto w = std::accumulate(m_width.begin() + begin, m_width.begin() + end, 0);
-        m_total_width -= w;
-        m_buf.erase(m_buf.begin() + begin, m_buf.begin() + end);
-        m_width.erase(m_width.begin() + begin, m_width.begin() + end);
-        m_style.erase(m_style.begin() + begin, m_style.begin() + end);
+        m_text.erase(byte_offset(begin), byte_offset(end));
+        m_bytes.erase(begin, end);
+        m_buf.erase(begin, end);
+        m_width.erase(begin, end);
+        m_cluster_start.erase(begin, end);
+        m_style.erase(begin, end);
+        segment(begin, begin);
     }
 
-    void swap(std::size_t a, std::size_t b) {
-        std::swap(m_buf[a], m_buf[b]);
-        std::swap(m_width[a], m_width[b]);
-        std::swap(m_style[a], m_style[b]);
+    // Moves [middle, end) in front of [begin, middle).
+    void rotate(std::size_t begin, std::size_t middle, std::size_t end) {
+        auto moved = substr(middle, end);
+        erase(middle, end);
+        insert(begin, moved);
+    }
+
+    void set_width_profile(const width_profile& widths) {
+        if (widths != m_widths) {
+            m_widths = widths;
+            measure(0, size());
+        }
     }
 
 private:
-    std::u32string m_buf;
-    std::vector<width_t> m_width;
-    std::vector<style_impl> m_style;
-    int m_total_width;
+    static bool printable_ascii(std::u32string_view str) {
+        return std::all_of(str.begin(), str.end(), [](char32_t c) { return c >= 0x20 && c < 0x7f; });
+    }
+
+    // Printable ASCII is one byte, one column and a cluster of its own, so a pasted run is filled in with bulk inserts.
+    // Only its ends are segmented, where it can join the clusters around it.
+    void insert_ascii(std::size_t i, std::u32string_view str) {
+        auto n = str.size();
+        m_text.insert(byte_offset(i), str.begin(), str.end());
+        m_bytes.insert(i, n, 1);
+        m_buf.insert(i, str.begin(), str.end());
+        m_width.insert(i, n, 1);
+        m_cluster_start.insert(i, n, 1);
+        m_style.insert(i, n);
+        segment(i, i + 1);
+        segment(i + n - 1, i + n);
+    }
+
+    void insert_text(std::size_t i, std::u32string_view str) {
+        auto offset = byte_offset(i);
+        for (std::size_t j = 0; j < str.size(); ++j) {
+            char bytes[4];
+            auto n = utf8_length(str[j]);
+            write_utf8(bytes, str[j]);
+            m_text.insert(offset, bytes, bytes + n);
+            m_bytes.insert(i + j, n);
+            offset += n;
+        }
+    }
+
+    void measure(std::size_t begin, std::size_t end) {
+        for (auto i = begin; i < end; ++i) {
+            if (m_cluster_start[i]) {
+                m_width.set(i, m_widths.width(m_buf[i]));
+            }
+        }
+    }
+
+    // Re-segments after an edit that touched [begin, end). Segmentation restarts at the start of the cluster before
+    // the edit and stops at the first boundary past it that was already a boundary, since everything after is
+    // unaffected. Only the first code point of a cluster carries its width.
+    void segment(std::size_t begin, std::size_t end) {
+        grapheme_segmenter segmenter;
+        for (auto i = prev_boundary(begin); i < size(); ++i) {
+            auto boundary = segmenter.next(m_buf[i]);
+            if (i >= end && boundary && m_cluster_start[i]) {
+                break;
+            }
+
+            m_cluster_start[i] = boundary;
+            m_width.set(i, boundary ? m_widths.width(m_buf[i]) : 0);
+        }
+    }
+
+    gap_buffer<char32_t> m_buf;
+    width_buffer m_width;
+    gap_buffer<uint8_t> m_cluster_start;
+    style_runs m_style;
+    width_profile m_widths;
+    // UTF-8 mirror of m_buf followed by a null, and the length of each code point's encoding so that offsets into it
+    // take O(log n).
+    gap_buffer<char> m_text = std::vector<char>(1, '\0');
+    width_buffer m_bytes;
 };
 
 } // namespace lined::detail
@@ -1,34 +1,57 @@
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include <optional>
-#include <stdexcept>
 #include <string>
+#include <string_view>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 namespace lined::detail {
 
+constexpr char32_t replacement_character = 0xfffd;
+
+// Invalid input decodes to U+FFFD, one per maximal invalid subsequence. When a sequence is cut short by a byte that
+// is not a valid continuation, that byte is not consumed and has to be written again.
 class utf8_decoder
 {
 public:
     std::optional<char32_t> write_char(uint8_t c) {
+        m_consumed = true;
         if (m_chars_required == 0) {
-            if (!(c & 0b10000000)) {
+            if (c < 0x80) {
                 return c;
-            } else if (c & 0b11000000 && !(c & 0b00100000)) {
+            } else if (c >= 0xc2 && c <= 0xdf) {
                 m_code_point = c & 0b00011111;
                 m_chars_required = 1;
-            } else if (c & 0b11100000 && !(c & 0b00010000)) {
+            } else if (c >= 0xe0 && c <= 0xef) {
                 m_code_point = c & 0b00001111;
                 m_chars_required = 2;
-            } else if (c & 0b11110000 && !(c & 0b00001000)) {
+                m_lower = c == 0xe0 ? 0xa0 : 0x80;
+                m_upper = c == 0xed ? 0x9f : 0xbf;
+            } else if (c >= 0xf0 && c <= 0xf4) {
                 m_code_point = c & 0b00000111;
                 m_chars_required = 3;
+                m_lower = c == 0xf0 ? 0x90 : 0x80;
+                m_upper = c == 0xf4 ? 0x8f : 0xbf;
             } else {
-                throw std::exception{};
+                return replacement_character;
             }
+        } else if (c < m_lower || c > m_upper) {
+            reset();
+            m_consumed = false;
+            return replacement_character;
         } else {
             m_code_point = (m_code_point << 6) + (c & 0b00111111);
-            m_chars_required--;
-            if (m_chars_required == 0) {
+            m_lower = 0x80;
+            m_upper = 0xbf;
+            if (--m_chars_required == 0) {
                 return m_code_point;
             }
         }
@@ -36,51 +59,232 @@ public:
         return {};
     }
 
+    bool consumed() const { return m_consumed; }
+    bool in_sequence() const { return m_chars_required > 0; }
+
+    void reset() {
+        m_chars_required = 0;
+        m_lower = 0x80;
+        m_upper = 0xbf;
+    }
+
 private:
     int m_chars_required = 0;
     char32_t m_code_point = 0;
+    uint8_t m_lower = 0x80;
+    uint8_t m_upper = 0xbf;
+    bool m_consumed = true;
 };
 
-inline std::u32string decode_utf8(std::string_view str) {
+// Widens the leading run of ASCII bytes of [src, src + n) into dst and returns its length.
+inline std::size_t widen_ascii(const char* src, std::size_t n, char32_t* dst) {
+    std::size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 32 <= n; i += 32) {
+        auto bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        if (_mm256_movemask_epi8(bytes) != 0) {
+            break;
+        }
+        for (std::size_t j = 0; j < 32; j += 8) {
+            auto eight = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i + j));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i + j), _mm256_cvtepu8_epi32(eight));
+        }
+    }
+#elif defined(__SSE2__)
+    auto zero = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16) {
+        auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        if (_mm_movemask_epi8(bytes) != 0) {
+            break;
+        }
+        auto lo = _mm_unpacklo_epi8(bytes, zero);
+        auto hi = _mm_unpackhi_epi8(bytes, zero);
+        auto* out = reinterpret_cast<__m128i*>(dst + i);
+        _mm_storeu_si128(out, _mm_unpacklo_epi16(lo, zero));
+        _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(lo, zero));
+        _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(hi, zero));
+        _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(hi, zero));
+    }
+#else
+    for (; i + 8 <= n; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, src + i, sizeof(word));
+        if (word & 0x8080808080808080) {
+            break;
+        }
+        for (std::size_t j = 0; j < 8; ++j) {
+            dst[i + j] = static_cast<uint8_t>(src[i + j]);
+        }
+    }
+#endif
+    for (; i < n && static_cast<uint8_t>(src[i]) < 0x80; ++i) {
+        dst[i] = static_cast<uint8_t>(src[i]);
+    }
+
+    return i;
+}
+
+// Narrows the leading run of ASCII code points of [src, src + n) into dst and returns its length.
+inline std::size_t narrow_ascii(const char32_t* src, std::size_t n, char* dst) {
+    std::size_t i = 0;
+#if defined(__SSE2__)
+    auto non_ascii = _mm_set1_epi32(~0x7f);
+    auto zero = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16) {
+        const auto* in = reinterpret_cast<const __m128i*>(src + i);
+        auto a = _mm_loadu_si128(in);
+        auto b = _mm_loadu_si128(in + 1);
+        auto c = _mm_loadu_si128(in + 2);
+        auto d = _mm_loadu_si128(in + 3);
+        auto any = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(any, non_ascii), zero)) != 0xffff) {
+            break;
+        }
+        auto bytes = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), bytes);
+    }
+#endif
+    for (; i < n && src[i] < 0x80; ++i) {
+        dst[i] = static_cast<char>(src[i]);
+    }
+
+    return i;
+}
+
+// Decodes one complete, valid multi-byte sequence from the start of [src, src + n) and returns its length, or 0 if
+// there is none.
+inline std::size_t decode_utf8_sequence(const char* src, std::size_t n, char32_t& code_point) {
+    auto byte = [&](std::size_t i) { return static_cast<uint8_t>(src[i]); };
+    auto lead = byte(0);
+    if (lead >= 0xc2 && lead <= 0xdf && n >= 2 && (byte(1) & 0xc0) == 0x80) {
+        code_point = (lead & 0b00011111) << 6 | (byte(1) & 0b00111111);
+        return 2;
+    } else if (lead >= 0xe0 && lead <= 0xef && n >= 3) {
+        uint8_t lower = lead == 0xe0 ? 0xa0 : 0x80;
+        uint8_t upper = lead == 0xed ? 0x9f : 0xbf;
+        if (byte(1) >= lower && byte(1) <= upper && (byte(2) & 0xc0) == 0x80) {
+            code_point = (lead & 0b00001111) << 12 | (byte(1) & 0b00111111) << 6 | (byte(2) & 0b00111111);
+            return 3;
+        }
+    } else if (lead >= 0xf0 && lead <= 0xf4 && n >= 4) {
+        uint8_t lower = lead == 0xf0 ? 0x90 : 0x80;
+        uint8_t upper = lead == 0xf4 ? 0x8f : 0xbf;
+        if (byte(1) >= lower && byte(1) <= upper && (byte(2) & 0xc0) == 0x80 && (byte(3) & 0xc0) == 0x80) {
+            code_point = (lead & 0b00000111) << 18 | (byte(1) & 0b00111111) << 12 | (byte(2) & 0b00111111) << 6 |
+                         (byte(3) & 0b00111111);
+            return 4;
+        }
+    }
+
+    return 0;
+}
+
+inline void decode_utf8(std::string_view str, std::u32string& out) {
+    auto start = out.size();
+    out.resize(start + str.size());
+    auto* dst = out.data() + start;
+
     utf8_decoder decoder;
-    std::u32string out;
-    out.reserve(str.size());
+    std::size_t i = 0;
+    while (i < str.size()) {
+        if (!decoder.in_sequence()) {
+            if (static_cast<uint8_t>(str[i]) < 0x80) {
+                auto n = widen_ascii(str.data() + i, str.size() - i, dst);
+                i += n;
+                dst += n;
+                continue;
+            } else if (auto n = decode_utf8_sequence(str.data() + i, str.size() - i, *dst)) {
+                i += n;
+                dst++;
+                continue;
+            }
+        }
 
-    for (auto c : str) {
-        if (auto wc = decoder.write_char(c)) {
-            out.push_back(*wc);
+        if (auto wc = decoder.write_char(str[i])) {
+            *dst++ = *wc;
         }
+        i += decoder.consumed();
     }
+    if (decoder.in_sequence()) {
+        *dst++ = replacement_character;
+    }
+
+    out.resize(dst - out.data());
+}
 
+inline std::u32string decode_utf8(std::string_view str) {
+    std::u32string out;
+    decode_utf8(str, out);
     return out;
 }
 
-inline std::string encode_utf8(std::u32string_view str) {
-    std::string out;
-    out.reserve(str.size());
-    for (auto code_point : str) {
-        if (code_point < 0x80) {
-            out.push_back(code_point);
-        } else if (0x80 <= code_point && code_point < 0x0800) {
-            out.reserve(out.size() + 2);
-            out.push_back(0b11000000 + ((code_point >> 6) & 0b00011111));
-            out.push_back(0b10000000 + (code_point & 0b00111111));
-        } else if (0x0800 <= code_point && code_point < 0x010000) {
-            out.reserve(out.size() + 3);
-            out.push_back(0b11100000 + ((code_point >> 12) & 0b00001111));
-            out.push_back(0b10000000 + ((code_point >> 6) & 0b00111111));
-            out.push_back(0b10000000 + (code_point & 0b00111111));
-        } else if (0x010000 <= code_point && code_point < 0x10FFFF) {
-            out.reserve(out.size() + 4);
-            out.push_back(0b11110000 + ((code_point >> 18) & 0b00000111));
-            out.push_back(0b10000000 + ((code_point >> 12) & 0b00111111));
-            out.push_back(0b10000000 + ((code_point >> 6) & 0b00111111));
-            out.push_back(0b10000000 + (code_point & 0b00111111));
-        } else {
-            throw std::runtime_error("Input is not valid UTF-8");
+constexpr bool is_encodable(char32_t code_point) {
+    return code_point < 0xd800 || (code_point > 0xdfff && code_point <= 0x10ffff);
+}
+
+// The number of bytes append_utf8 writes for code_point.
+constexpr int utf8_length(char32_t code_point) {
+    if (code_point < 0x80) {
+        return 1;
+    } else if (code_point < 0x0800) {
+        return 2;
+    } else if (code_point < 0x010000 || !is_encodable(code_point)) {
+        return 3;
+    } else {
+        return 4;
+    }
+}
+
+// Writes utf8_length(code_point) bytes to out.
+inline void write_utf8(char* out, char32_t code_point) {
+    if (!is_encodable(code_point)) {
+        code_point = replacement_character;
+    }
+
+    if (code_point < 0x80) {
+        out[0] = code_point;
+    } else if (code_point < 0x0800) {
+        out[0] = 0b11000000 + ((code_point >> 6) & 0b00011111);
+        out[1] = 0b10000000 + (code_point & 0b00111111);
+    } else if (code_point < 0x010000) {
+        out[0] = 0b11100000 + ((code_point >> 12) & 0b00001111);
+        out[1] = 0b10000000 + ((code_point >> 6) & 0b00111111);
+        out[2] = 0b10000000 + (code_point & 0b00111111);
+    } else {
+        out[0] = 0b11110000 + ((code_point >> 18) & 0b00000111);
+        out[1] = 0b10000000 + ((code_point >> 12) & 0b00111111);
+        out[2] = 0b10000000 + ((code_point >> 6) & 0b00111111);
+        out[3] = 0b10000000 + (code_point & 0b00111111);
+    }
+}
+
+inline void append_utf8(std::string& out, char32_t code_point) {
+    char bytes[4];
+    write_utf8(bytes, code_point);
+    out.append(bytes, utf8_length(code_point));
+}
+
+inline void encode_utf8(std::u32string_view str, std::string& out) {
+    char ascii[64];
+    std::size_t i = 0;
+    while (i < str.size()) {
+        std::size_t n;
+        do {
+            n = narrow_ascii(str.data() + i, std::min(str.size() - i, sizeof(ascii)), ascii);
+            out.append(ascii, n);
+            i += n;
+        } while (n == sizeof(ascii));
+
+        for (; i < str.size() && str[i] >= 0x80; ++i) {
+            append_utf8(out, str[i]);
         }
     }
+}
 
+inline std::string encode_utf8(std::u32string_view str) {
+    std::string out;
+    out.reserve(str.size());
+    encode_utf8(str, out);
     return out;
 }
 
@@ -88,4 +292,4 @@ constexpr bool is_continuation_byte(uint8_t c) {
     return (c & 0b10000000) && !(c & 0b01000000);
 }
 
-} // namespace lined::detail
\ No newline at end of file
+} // namespace lined::detail
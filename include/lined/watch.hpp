@@ -0,0 +1,126 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <poll.h>
+#include <vector>
+
+namespace lined {
+
+using watch_callback_t = void(int, short);
+using timer_callback_t = void();
+using timer_id = uint64_t;
+
+namespace detail {
+
+class watch_set
+{
+    using clock = std::chrono::steady_clock;
+
+public:
+    void watch(int fd, short events, std::function<watch_callback_t> callback) {
+        unwatch(fd);
+        m_watches.push_back({fd, events, std::move(callback), false});
+    }
+
+    void unwatch(int fd) {
+        for (auto& w : m_watches) {
+            if (w.fd == fd) {
+                w.removed = true;
+            }
+        }
+    }
+
+    timer_id add_timer(std::chrono::milliseconds interval, std::function<timer_callback_t> callback) {
+        auto id = ++m_last_timer_id;
+        m_timers.push_back({id, interval, clock::now() + interval, std::move(callback), false});
+        return id;
+    }
+
+    void remove_timer(timer_id id) {
+        for (auto& t : m_timers) {
+            if (t.id == id) {
+                t.removed = true;
+            }
+        }
+    }
+
+    void append_poll_items(std::vector<pollfd>& items) {
+        compact();
+        for (auto& w : m_watches) {
+            items.push_back({w.fd, w.events, 0});
+        }
+    }
+
+    int timeout_ms() const {
+        if (m_timers.empty()) {
+            return -1;
+        }
+
+        auto now = clock::now();
+        auto next = std::min_element(m_timers.begin(), m_timers.end(),
+                                     [](const auto& a, const auto& b) { return a.deadline < b.deadline; });
+        auto ms = std::chrono::ceil<std::chrono::milliseconds>(next->deadline - now).count();
+        return ms > 0 ? static_cast<int>(ms) : 0;
+    }
+
+    void dispatch(const pollfd* items, std::size_t n_items) {
+        for (std::size_t i = 0; i < n_items; ++i) {
+            auto& w = m_watches[i];
+            if (items[i].revents && !w.removed) {
+                w.callback(w.fd, items[i].revents);
+            }
+        }
+
+        auto now = clock::now();
+        for (std::size_t i = 0, n = m_timers.size(); i < n; ++i) {
+            auto& t = m_timers[i];
+            if (t.removed || t.deadline > now) {
+                continue;
+            }
+
+            t.deadline += t.interval;
+            if (t.deadline <= now) {
+                t.deadline = now + t.interval;
+            }
+
+            t.callback();
+        }
+    }
+
+private:
+    struct watch_entry
+    {
+        int fd;
+        short events;
+        std::function<watch_callback_t> callback;
+        bool removed;
+    };
+
+    struct timer_entry
+    {
+        timer_id id;
+        std::chrono::milliseconds interval;
+        clock::time_point deadline;
+        std::function<timer_callback_t> callback;
+        bool removed;
+    };
+
+    void compact() {
+        m_watches.erase(std::remove_if(m_watches.begin(), m_watches.end(), [](auto& w) { return w.removed; }),
+                        m_watches.end());
+        m_timers.erase(std::remove_if(m_timers.begin(), m_timers.end(), [](auto& t) { return t.removed; }),
+                       m_timers.end());
+    }
+
+    std::deque<watch_entry> m_watches;
+    std::deque<timer_entry> m_timers;
+    timer_id m_last_timer_id = 0;
+};
+
+} // namespace detail
+
+} // namespace lined
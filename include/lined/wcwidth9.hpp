@@ -1,6 +1,10 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <cstdint>
+#include <iterator>
+#include <tuple>
 #include <uchar.h>
 
 namespace lined::detail {
@@ -340,15 +344,136 @@ constexpr int wcwidth9(char32_t c) {
     return 1;
 }
 
+struct wcwidth9_class
+{
+    const wcwidth9_interval* table;
+    std::size_t size;
+    uint8_t width;
+};
+
+// The interval tables in the order wcwidth9 checks them, with the widths wcwidth9_norm reports for them.
+constexpr wcwidth9_class wcwidth9_classes[] = {
+    {wcwidth9_nonprint, std::size(wcwidth9_nonprint), 0},
+    {wcwidth9_combining, std::size(wcwidth9_combining), 0},
+    {wcwidth9_not_assigned, std::size(wcwidth9_not_assigned), 0},
+    {wcwidth9_private, std::size(wcwidth9_private), 1},
+    {wcwidth9_ambiguous, std::size(wcwidth9_ambiguous), 1},
+    {wcwidth9_doublewidth, std::size(wcwidth9_doublewidth), 2},
+    {wcwidth9_emoji_width, std::size(wcwidth9_emoji_width), 2},
+};
+
+constexpr std::size_t wcwidth9_page_size = 256;
+constexpr std::size_t wcwidth9_page_count = 0x110000 / wcwidth9_page_size;
+constexpr uint8_t wcwidth9_mixed = 3;
+
+// The width shared by every code point of each page, or wcwidth9_mixed. A page belongs to the first class in
+// priority order that touches it.
+constexpr std::array<uint8_t, wcwidth9_page_count> wcwidth9_make_page_widths() {
+    std::array<uint8_t, wcwidth9_page_count> widths{};
+    std::array<bool, wcwidth9_page_count> claimed{};
+    for (const auto& cls : wcwidth9_classes) {
+        for (std::size_t i = 0; i < cls.size; ++i) {
+            auto [first, last] = cls.table[i];
+            for (auto page = first / wcwidth9_page_size; page <= last / wcwidth9_page_size; ++page) {
+                long page_first = page * wcwidth9_page_size;
+                long page_last = page_first + wcwidth9_page_size - 1;
+                if (!claimed[page]) {
+                    claimed[page] = true;
+                    widths[page] = first <= page_first && last >= page_last ? cls.width : wcwidth9_mixed;
+                }
+            }
+        }
+    }
+
+    for (std::size_t page = 0; page < wcwidth9_page_count; ++page) {
+        if (!claimed[page]) {
+            widths[page] = 1;
+        }
+    }
+
+    return widths;
+}
+
+inline constexpr auto wcwidth9_page_widths = wcwidth9_make_page_widths();
+
+constexpr std::size_t wcwidth9_count_mixed_pages() {
+    std::size_t n = 0;
+    for (auto w : wcwidth9_page_widths) {
+        n += w == wcwidth9_mixed;
+    }
+
+    return n;
+}
+
+// Two-stage lookup: a page index per 256 code points, and pages of 2-bit widths. Pages 0-2 are the uniform ones.
+struct wcwidth9_lookup
+{
+    using page = std::array<uint8_t, wcwidth9_page_size / 4>;
+
+    std::array<uint8_t, wcwidth9_page_count> index;
+    std::array<page, 3 + wcwidth9_count_mixed_pages()> pages;
+};
+
+static_assert(std::tuple_size_v<decltype(wcwidth9_lookup::pages)> <= 256);
+
+constexpr wcwidth9_lookup wcwidth9_make_lookup() {
+    wcwidth9_lookup lookup{};
+    uint8_t next = 0;
+    for (std::size_t page = 0; page < wcwidth9_page_count; ++page) {
+        auto w = wcwidth9_page_widths[page];
+        lookup.index[page] = w == wcwidth9_mixed ? 3 + next++ : w;
+    }
+    for (uint8_t w = 0; w < 3 + next; ++w) {
+        for (auto& bits : lookup.pages[w]) {
+            bits = (w < 3 ? w : 1) * 0b01010101;
+        }
+    }
+
+    // Paint the mixed pages from the lowest priority class up, so that higher priority classes win.
+    for (auto cls = std::end(wcwidth9_classes); cls != std::begin(wcwidth9_classes);) {
+        --cls;
+        for (std::size_t i = 0; i < cls->size; ++i) {
+            auto [first, last] = cls->table[i];
+            for (auto c = first; c <= last; ++c) {
+                auto page = c / wcwidth9_page_size;
+                if (wcwidth9_page_widths[page] != wcwidth9_mixed) {
+                    c = (page + 1) * wcwidth9_page_size - 1;
+                    continue;
+                }
+
+                auto& bits = lookup.pages[lookup.index[page]][c % wcwidth9_page_size / 4];
+                if (c % 4 == 0 && c + 3 <= last) {
+                    bits = cls->width * 0b01010101;
+                    c += 3;
+                } else {
+                    auto shift = c % 4 * 2;
+                    bits = (bits & ~(0b11 << shift)) | cls->width << shift;
+                }
+            }
+        }
+    }
+
+    return lookup;
+}
+
+inline constexpr auto wcwidth9_table = wcwidth9_make_lookup();
+
 constexpr int wcwidth9_norm(char32_t c) {
-    auto width = wcwidth9(c);
-    if (width > 0) {
-        return width;
-    } else if (width == -1) {
+    if (c < 0x7f) {
+        return c >= 0x20;
+    } else if (c > 0x10ffff) {
         return 0;
-    } else {
-        return 1;
     }
+
+    const auto& page = wcwidth9_table.pages[wcwidth9_table.index[c / wcwidth9_page_size]];
+    return page[c % wcwidth9_page_size / 4] >> (c % 4 * 2) & 0b11;
 }
 
+// Spot checks against the interval tables, one per class and across a mixed page. tests/width_table.cpp compares
+// every code point.
+static_assert(wcwidth9_norm(0x00ad) == 0 && wcwidth9_norm(0x0301) == 0 && wcwidth9_norm(0x0378) == 0);
+static_assert(wcwidth9_norm(0xe000) == 1 && wcwidth9_norm(0x2605) == 1 && wcwidth9_norm(0x00e9) == 1);
+static_assert(wcwidth9_norm(0x4e00) == 2 && wcwidth9_norm(0x1f600) == 2 && wcwidth9_norm(0x231a) == 2);
+static_assert(wcwidth9_norm(0x1100) == 2 && wcwidth9_norm(0x115f) == 2 && wcwidth9_norm(0x1160) == 1);
+
 } // namespace lined::detail
\ No newline at end of file
@@ -0,0 +1,214 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace lined::detail {
+
+using width_t = int8_t;
+
+// Gap buffer of cell widths with a Fenwick tree over the physical slots. Slots inside the gap hold width 0, so
+// inserting or erasing at the gap only touches O(log n) tree nodes and prefix sums never need reindexing.
+class width_buffer
+{
+    static constexpr std::size_t min_gap = 16;
+
+public:
+    width_buffer() {}
+    width_buffer(std::vector<width_t> widths) : m_data(std::move(widths)), m_gap_start(m_data.size()) {
+        m_gap_end = m_gap_start;
+        rebuild();
+    }
+
+    std::size_t size() const { return m_data.size() - gap_size(); }
+    bool empty() const { return size() == 0; }
+
+    width_t operator[](std::size_t i) const { return m_data[physical(i)]; }
+
+    void set(std::size_t i, width_t w) { put(physical(i), w); }
+
+    void insert(std::size_t i, std::size_t n, width_t w) {
+        make_gap(i, n);
+        if (n > m_data.size() / 8) {
+            std::fill_n(m_data.begin() + m_gap_start, n, w);
+            m_gap_start += n;
+            rebuild();
+            return;
+        }
+
+        for (std::size_t j = 0; j < n; ++j) {
+            put(m_gap_start++, w);
+        }
+    }
+
+    void insert(std::size_t i, width_t w) { insert(i, 1, w); }
+
+    void push_back(width_t w) { insert(size(), w); }
+
+    void erase(std::size_t begin, std::size_t end) {
+        move_gap(begin);
+        auto n = end - begin;
+        if (n > m_data.size() / 8) {
+            std::fill_n(m_data.begin() + m_gap_end, n, 0);
+            m_gap_end += n;
+            rebuild();
+            return;
+        }
+
+        for (auto p = m_gap_end; p < m_gap_end + n; ++p) {
+            put(p, 0);
+        }
+        m_gap_end += n;
+    }
+
+    void clear() {
+        m_data.clear();
+        m_tree.clear();
+        m_gap_start = 0;
+        m_gap_end = 0;
+    }
+
+    std::vector<width_t> slice(std::size_t begin, std::size_t end) const {
+        std::vector<width_t> widths;
+        widths.reserve(end - begin);
+        for (auto i = begin; i < end; ++i) {
+            widths.push_back((*this)[i]);
+        }
+
+        return widths;
+    }
+
+    int total() const { return prefix(m_data.size()); }
+
+    int sum(std::size_t begin, std::size_t end) const { return prefix(boundary(end)) - prefix(boundary(begin)); }
+
+    // Largest end such that the cells in [start, end) fit in max_width columns.
+    std::size_t forward(std::size_t start, int max_width) const {
+        return logical(upper(prefix(boundary(start)) + max_width));
+    }
+
+    // Smallest start such that the cells in [start, end) fit in max_width columns.
+    std::size_t backward(std::size_t end, int max_width) const {
+        auto target = prefix(boundary(end)) - max_width;
+        return target <= 0 ? 0 : logical(lower(target) + 1);
+    }
+
+private:
+    std::size_t gap_size() const { return m_gap_end - m_gap_start; }
+    std::size_t physical(std::size_t i) const { return i < m_gap_start ? i : i + gap_size(); }
+    std::size_t boundary(std::size_t i) const { return i <= m_gap_start ? i : i + gap_size(); }
+
+    std::size_t logical(std::size_t p) const {
+        if (p <= m_gap_start) {
+            return p;
+        }
+        return p < m_gap_end ? m_gap_start : p - gap_size();
+    }
+
+    int prefix(std::size_t p) const {
+        int s = 0;
+        for (; p > 0; p -= p & -p) {
+            s += m_tree[p];
+        }
+
+        return s;
+    }
+
+    // Largest p with prefix(p) <= target.
+    std::size_t upper(int target) const {
+        std::size_t p = 0;
+        for (auto step = top_bit(); step > 0; step >>= 1) {
+            if (p + step < m_tree.size() && m_tree[p + step] <= target) {
+                p += step;
+                target -= m_tree[p];
+            }
+        }
+
+        return p;
+    }
+
+    // Largest p with prefix(p) < target.
+    std::size_t lower(int target) const {
+        std::size_t p = 0;
+        for (auto step = top_bit(); step > 0; step >>= 1) {
+            if (p + step < m_tree.size() && m_tree[p + step] < target) {
+                p += step;
+                target -= m_tree[p];
+            }
+        }
+
+        return p;
+    }
+
+    std::size_t top_bit() const {
+        std::size_t step = 1;
+        while (step * 2 < m_tree.size()) {
+            step *= 2;
+        }
+
+        return m_tree.size() > 1 ? step : 0;
+    }
+
+    void put(std::size_t p, width_t w) {
+        int delta = w - m_data[p];
+        m_data[p] = w;
+        if (delta != 0) {
+            for (auto k = p + 1; k < m_tree.size(); k += k & -k) {
+                m_tree[k] += delta;
+            }
+        }
+    }
+
+    void rebuild() {
+        m_tree.assign(m_data.size() + 1, 0);
+        for (std::size_t k = 1; k < m_tree.size(); ++k) {
+            m_tree[k] += m_data[k - 1];
+            auto parent = k + (k & -k);
+            if (parent < m_tree.size()) {
+                m_tree[parent] += m_tree[k];
+            }
+        }
+    }
+
+    void move_gap(std::size_t i) {
+        if (gap_size() == 0) {
+            m_gap_start = i;
+            m_gap_end = i;
+            return;
+        }
+
+        while (i < m_gap_start) {
+            put(--m_gap_end, m_data[--m_gap_start]);
+            put(m_gap_start, 0);
+        }
+        while (i > m_gap_start) {
+            put(m_gap_start++, m_data[m_gap_end]);
+            put(m_gap_end++, 0);
+        }
+    }
+
+    void make_gap(std::size_t i, std::size_t n) {
+        move_gap(i);
+        if (gap_size() >= n) {
+            return;
+        }
+
+        auto tail = m_data.size() - m_gap_end;
+        auto new_gap = std::max(n, std::max(size(), min_gap));
+        std::vector<width_t> data(m_gap_start + new_gap + tail);
+        std::copy(m_data.begin(), m_data.begin() + m_gap_start, data.begin());
+        std::copy(m_data.begin() + m_gap_end, m_data.end(), data.end() - tail);
+        m_data = std::move(data);
+        m_gap_end = m_gap_start + new_gap;
+        rebuild();
+    }
+
+    std::vector<width_t> m_data;
+    std::vector<int> m_tree;
+    std::size_t m_gap_start = 0;
+    std::size_t m_gap_end = 0;
+};
+
+} // namespace lined::detail
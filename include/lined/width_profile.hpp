@@ -0,0 +1,140 @@
+#pragma once
+
+#include "wcwidth9.hpp"
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+namespace lined::detail {
+
+// The widths a terminal actually uses for the classes of code points that terminals disagree about. Everything else
+// is measured by wcwidth9_norm.
+struct width_profile
+{
+    enum width_class : uint8_t
+    {
+        ambiguous,
+        private_use,
+        emoji,
+        wide_emoji,
+        count
+    };
+
+    std::array<uint8_t, count> widths = {1, 1, 2, 2};
+
+    bool is_default() const { return *this == width_profile{}; }
+
+    bool operator==(const width_profile& other) const { return widths == other.widths; }
+    bool operator!=(const width_profile& other) const { return widths != other.widths; }
+
+    int width(char32_t c) const {
+        auto w = wcwidth9_norm(c);
+        if (c < 0xa1 || is_default()) {
+            return w;
+        }
+
+        if (w == 1) {
+            if (wcwidth9_intable(wcwidth9_private, std::size(wcwidth9_private), c)) {
+                return widths[private_use];
+            } else if (wcwidth9_intable(wcwidth9_ambiguous, std::size(wcwidth9_ambiguous), c)) {
+                return widths[ambiguous];
+            }
+        } else if (w == 2 && c >= 0x1f000) {
+            if (wcwidth9_intable(wcwidth9_doublewidth, std::size(wcwidth9_doublewidth), c)) {
+                return c <= 0x1faff ? widths[wide_emoji] : 2;
+            } else {
+                return widths[emoji];
+            }
+        }
+
+        return w;
+    }
+};
+
+// A code point from each width_profile class, printed to measure the width the terminal gives it.
+constexpr std::array<std::string_view, width_profile::count> width_probes = {
+    "\u2605",     // BLACK STAR, East Asian ambiguous
+    "\ue000",     // the first private use code point
+    "\U0001f321", // THERMOMETER, an emoji with text presentation by default
+    "\U0001f600", // GRINNING FACE, a wide emoji
+};
+
+constexpr std::array<std::string_view, width_profile::count> width_class_names = {
+    "ambiguous",
+    "private_use",
+    "emoji",
+    "wide_emoji",
+};
+
+// Where the calibrated widths for the terminal named by $TERM are cached, or an empty path if there is no $TERM or
+// no cache directory.
+inline std::filesystem::path width_cache_path() {
+    const char* term = std::getenv("TERM");
+    if (!term || !*term) {
+        return {};
+    }
+
+    std::filesystem::path dir;
+    if (const char* xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg) {
+        dir = xdg;
+    } else if (const char* home = std::getenv("HOME"); home && *home) {
+        dir = std::filesystem::path(home) / ".cache";
+    } else {
+        return {};
+    }
+
+    std::string name(term);
+    for (auto& c : name) {
+        if (c == '/') {
+            c = '_';
+        }
+    }
+
+    return dir / "lined" / "widths" / name;
+}
+
+inline std::optional<width_profile> load_width_profile(const std::filesystem::path& path) {
+    std::ifstream file(path);
+    if (!file) {
+        return {};
+    }
+
+    width_profile profile;
+    std::array<bool, width_profile::count> seen{};
+    std::string name;
+    int width;
+    while (file >> name >> width) {
+        for (std::size_t i = 0; i < width_class_names.size(); ++i) {
+            if (name == width_class_names[i] && (width == 1 || width == 2)) {
+                profile.widths[i] = width;
+                seen[i] = true;
+            }
+        }
+    }
+
+    for (auto s : seen) {
+        if (!s) {
+            return {};
+        }
+    }
+
+    return profile;
+}
+
+inline void save_width_profile(const std::filesystem::path& path, const width_profile& profile) {
+    std::error_code ec;
+    std::filesystem::create_directories(path.parent_path(), ec);
+
+    std::ofstream file(path);
+    for (std::size_t i = 0; i < width_class_names.size(); ++i) {
+        file << width_class_names[i] << " " << int(profile.widths[i]) << "\n";
+    }
+}
+
+} // namespace lined::detail
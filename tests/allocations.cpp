@@ -0,0 +1,89 @@
+// Counts operator new calls over a steady-state keystroke loop. Once the scratch buffers have grown to fit the line,
+// inserting, erasing and moving the cursor must not allocate.
+
+#include "lined/lined.hpp"
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <new>
+
+static std::size_t allocations = 0;
+
+void* operator new(std::size_t n) {
+    allocations++;
+    if (void* p = std::malloc(n ? n : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t n) { return operator new(n); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+
+using namespace lined;
+
+// Insert, cursor, erase and delete keys that leave the line as it was.
+constexpr const char* keys[] = {"x", "\x1b[D", "\x1b[3~", "y", "\x7f", "\x1b[H", "z", "\x1b[C", "\x1b[D",
+                                "\x1b[3~", "\x1b[F", "\x1b[D", "\x1b[D", "\x1b[C", "\x1b[C"};
+
+static bool check(const char* name, const std::function<void(editor&)>& setup) {
+    editor e;
+    e.resize(40);
+    setup(e);
+    e.start("> ");
+    e.feed("\x1b[200~let x = 10; // caf\xc3\xa9 \xe5\xad\x97 long enough to wrap\x1b[201~");
+    e.drain_output();
+
+    auto cycle = [&] {
+        for (auto k : keys) {
+            e.feed(k);
+            e.drain_output();
+        }
+    };
+
+    for (int i = 0; i < 50; ++i) {
+        cycle();
+    }
+
+    constexpr int cycles = 500;
+    auto before = allocations;
+    for (int i = 0; i < cycles; ++i) {
+        cycle();
+    }
+    auto count = allocations - before;
+
+    std::printf("%-22s %zu allocations over %zu keys\n", name, count, cycles * std::size(keys));
+    return count == 0;
+}
+
+int main() {
+    auto digits = [](char c) { return c >= '0' && c <= '9' ? style{.fg = color::red()} : style{}; };
+
+    bool ok = true;
+    ok &= check("no callbacks", [](editor&) {});
+    ok &= check("colorization", [&](editor& e) {
+        e.set_colorization([&](std::string_view s, style_iterator it) {
+            for (std::size_t i = 0; i < s.size(); ++i, ++it) {
+                *it = digits(s[i]);
+            }
+        });
+    });
+    ok &= check("incremental", [&](editor& e) {
+        e.set_colorization([&](std::string_view s, text_edit edit, style_iterator it) {
+            for (auto i = edit.begin; i < edit.new_end; ++i, ++it) {
+                *it = digits(s[i]);
+            }
+        });
+    });
+    ok &= check("hint, soft wrap", [](editor& e) {
+        e.set_soft_wrap(true);
+        e.set_hint([](std::string_view) -> std::string { return " <hint>"; });
+    });
+    ok &= check("masked", [](editor& e) { e.mask(); });
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,111 @@
+// Edits in the middle of the line with callbacks that read the text in place, and checks that they see the same text
+// and draw the same styles as callbacks that read it as one contiguous string. Also colors a single line with more
+// styles than a palette can number.
+
+#include "lined/editor.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+using namespace lined;
+
+static int failures = 0;
+
+#define CHECK(cond)                                                                                                    \
+    do {                                                                                                               \
+        if (!(cond)) {                                                                                                 \
+            std::printf("%s:%d: %s\n", __FILE__, __LINE__, #cond);                                                     \
+            failures++;                                                                                                \
+        }                                                                                                              \
+    } while (0)
+
+static style digit_style(char c) { return c >= '0' && c <= '9' ? style{.fg = color::red()} : style{}; }
+
+// Types at the end, moves into the middle and types there, so the gap ends up inside the text.
+static std::string type_mid_line(editor& e) {
+    e.resize(80);
+    e.start("> ");
+    e.feed("ab12cd");
+    e.feed("\x1b[D\x1b[D\x1b[D");
+    e.feed("x3");
+    e.feed("\x7f");
+    e.feed("4y");
+    return std::string(e.drain_output());
+}
+
+static void pieces() {
+    editor e;
+    std::string seen;
+    bool split = false;
+    e.set_hint([&](text_view text, text_edit) {
+        seen = std::string(text.first()) + std::string(text.second());
+        split = !text.first().empty() && !text.second().empty();
+        CHECK(seen.size() == text.size());
+        return std::string();
+    });
+    type_mid_line(e);
+    CHECK(seen == "ab1x4y2cd");
+    CHECK(split);
+}
+
+static void styles_across_gap() {
+    editor full;
+    full.set_colorization([](std::string_view text, style_iterator it) {
+        for (auto c : text) {
+            *it++ = digit_style(c);
+        }
+    });
+    auto expected = type_mid_line(full);
+
+    // Restyles from the edit to the end of the line, which crosses the gap
+    editor in_place;
+    in_place.set_colorization([](text_view text, text_edit edit, style_iterator it) {
+        for (auto i = edit.begin; i < text.size(); ++i) {
+            *it++ = digit_style(text[i]);
+        }
+    });
+    CHECK(type_mid_line(in_place) == expected);
+
+    // Closing the gap moves the text under an iterator that was created before
+    editor contiguous;
+    contiguous.set_colorization([](text_view view, text_edit edit, style_iterator it) {
+        std::string_view text = view;
+        for (auto i = edit.begin; i < text.size(); ++i) {
+            *it++ = digit_style(text[i]);
+        }
+    });
+    CHECK(type_mid_line(contiguous) == expected);
+}
+
+// Every change gets a new color, and only the latest is in use, so the palette has to drop the old ones within the line
+static void many_styles() {
+    editor e;
+    unsigned n = 0;
+    auto color_of = [](unsigned i) { return color(i >> 16 & 0xff, i >> 8 & 0xff, i & 0xff); };
+    e.set_colorization([&](std::string_view text, style_iterator it) {
+        n++;
+        for (std::size_t i = 0; i < text.size(); ++i) {
+            *it++ = style{.fg = color_of(n)};
+        }
+    });
+    e.resize(80);
+    e.start("> ");
+    for (int i = 0; i < 140000; ++i) {
+        e.feed(i % 2 ? "\x7f" : "a");
+        e.drain_output();
+    }
+
+    e.feed("b");
+    auto sgr = "\x1b[38;2;" + std::to_string(n >> 16 & 0xff) + ";" + std::to_string(n >> 8 & 0xff) + ";" +
+               std::to_string(n & 0xff) + "mb";
+    CHECK(std::string(e.drain_output()).find(sgr) != std::string::npos);
+}
+
+int main() {
+    pieces();
+    styles_across_gap();
+    many_styles();
+
+    std::printf("%d failures\n", failures);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
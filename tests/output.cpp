@@ -0,0 +1,162 @@
+// Prints from other threads and from the reader's own callbacks while lines are read on a pty, and checks that
+// nobody waits on a lock that the reader or a writer to a busy terminal is holding.
+
+#include "lined/lined.hpp"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+using namespace lined;
+
+static int failures = 0;
+
+#define CHECK(cond)                                                                                                    \
+    do {                                                                                                               \
+        if (!(cond)) {                                                                                                 \
+            std::printf("%s:%d: %s\n", __FILE__, __LINE__, #cond);                                                     \
+            failures++;                                                                                                \
+        }                                                                                                              \
+    } while (0)
+
+// A pty whose output is collected on a separate thread, so that writes to the slave never block.
+struct pty
+{
+    int master = -1;
+    int slave = -1;
+    std::mutex mutex;
+    std::string output;
+    std::atomic<bool> done = false;
+    std::thread collector;
+
+    pty() {
+        master = posix_openpt(O_RDWR | O_NOCTTY);
+        grantpt(master);
+        unlockpt(master);
+        slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+        fcntl(master, F_SETFL, O_NONBLOCK);
+        collector = std::thread([this] {
+            char buf[4096];
+            while (!done) {
+                auto n = read(master, buf, sizeof(buf));
+                if (n > 0) {
+                    std::scoped_lock lk(mutex);
+                    output.append(buf, n);
+                } else {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+            }
+        });
+    }
+
+    ~pty() {
+        done = true;
+        collector.join();
+        close(slave);
+        close(master);
+    }
+
+    void type(std::string_view input) { [[maybe_unused]] auto unused = write(master, input.data(), input.size()); }
+
+    bool wait_for(std::string_view text) {
+        for (int i = 0; i < 1000; ++i) {
+            {
+                std::scoped_lock lk(mutex);
+                if (output.find(text) != std::string::npos) {
+                    return true;
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return false;
+    }
+};
+
+static options pty_options(const pty& p) {
+    options opt{p.slave, p.slave, 100, true, {}};
+    opt.print_queue_size = 2;
+    return opt;
+}
+
+// The queue holds two texts and only the reader thread drains it, so a blocking print_above from a callback on that
+// thread has to set the third text aside instead of waiting.
+static void print_above_from_callback() {
+    pty p;
+    line_reader reader(pty_options(p));
+    reader.set_hint([&](std::string_view text) {
+        reader.print_above("first " + std::string(text));
+        reader.print_above("second " + std::string(text));
+        reader.print_above("third " + std::string(text));
+        return std::string();
+    });
+
+    std::thread typist([&] {
+        p.wait_for("> ");
+        p.type("ab\r");
+    });
+    auto l = reader.getline("> ");
+    typist.join();
+    CHECK(l && *l == "ab");
+    CHECK(p.wait_for("first ab"));
+    CHECK(p.wait_for("second ab"));
+    CHECK(p.wait_for("third ab"));
+}
+
+// With no line active, a thread that has disabled output holds the write lock, and print_above queues its text for
+// it rather than waiting.
+static void print_above_while_disabled() {
+    pty p;
+    line_reader reader(pty_options(p));
+    std::atomic<int> step = 0;
+    std::thread disabler([&] {
+        reader.disable_output();
+        step = 1;
+        while (step != 2) {
+            std::this_thread::yield();
+        }
+        reader.enable_output();
+    });
+
+    while (step != 1) {
+        std::this_thread::yield();
+    }
+    reader.print_above("queued\n");
+    step = 2;
+    disabler.join();
+    CHECK(p.wait_for("queued"));
+}
+
+// disable_output on another thread while getline waits for input: the reader erases its line and parks until
+// enable_output, then carries on with the line.
+static void disable_while_reading() {
+    pty p;
+    line_reader reader(pty_options(p));
+    std::thread disabler([&] {
+        p.wait_for("> ");
+        reader.disable_output();
+        [[maybe_unused]] auto unused = write(p.slave, "between\n", 8);
+        reader.enable_output();
+        p.type("ab\r");
+    });
+
+    auto l = reader.getline("> ");
+    disabler.join();
+    CHECK(l && *l == "ab");
+    CHECK(p.wait_for("between"));
+}
+
+int main() {
+    // A deadlock never returns
+    alarm(10);
+
+    print_above_from_callback();
+    print_above_while_disabled();
+    disable_while_reading();
+
+    std::printf("%d failures\n", failures);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
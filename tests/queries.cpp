@@ -0,0 +1,112 @@
+// Feeds simulated terminal replies to the editor's queries, including replies that never come, arrive late or are
+// cut off by the escape deadline, and keys that look like replies once none is expected.
+
+#include "lined/editor.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+using namespace lined;
+
+static int failures = 0;
+
+#define CHECK(cond)                                                                                                    \
+    do {                                                                                                               \
+        if (!(cond)) {                                                                                                 \
+            std::printf("%s:%d: %s\n", __FILE__, __LINE__, #cond);                                                     \
+            failures++;                                                                                                \
+        }                                                                                                              \
+    } while (0)
+
+static std::string finish(editor& e, std::string_view input) {
+    auto l = e.feed(input);
+    return l && l->has_value() ? l->value() : "<no line>";
+}
+
+static void sync_output_reply() {
+    editor e;
+    e.query_synchronized_output();
+    e.start("> ");
+    CHECK(e.escape_pending());
+    e.feed("\x1b[?2026;2$y");
+    CHECK(e.synchronized_output());
+    CHECK(!e.escape_pending());
+    CHECK(finish(e, "ab\r") == "ab");
+}
+
+static void sync_output_unanswered() {
+    editor e;
+    e.query_synchronized_output();
+    e.start("> ");
+    e.feed("ab");
+    CHECK(e.escape_pending());
+    e.expire_escape();
+    CHECK(!e.escape_pending());
+
+    // A reply after the deadline is dropped
+    e.feed("\x1b[?2026;2$y");
+    CHECK(!e.synchronized_output());
+    CHECK(finish(e, "c\r") == "abc");
+}
+
+static void sync_output_cut_off() {
+    editor e;
+    e.query_synchronized_output();
+    e.start("> ");
+    e.feed("\x1b[?20");
+    e.expire_escape();
+    CHECK(!e.synchronized_output());
+
+    // The rest of the reply is skipped rather than typed into the line
+    e.feed("26;2$yab");
+    CHECK(!e.synchronized_output());
+    CHECK(finish(e, "\r") == "ab");
+}
+
+static void widths_reply() {
+    editor e;
+    e.query_widths();
+    e.start("> ");
+    CHECK(e.widths_pending() && e.escape_pending());
+    e.feed("\x1b[1;3R\x1b[1;2R");
+    CHECK(e.widths_pending());
+    e.feed("\x1b[1;3R\x1b[1;3R");
+    CHECK(!e.widths_pending() && !e.escape_pending());
+    CHECK(e.widths().widths[detail::width_profile::ambiguous] == 2);
+    CHECK(e.widths().widths[detail::width_profile::private_use] == 1);
+    CHECK(finish(e, "ab\r") == "ab");
+}
+
+static void widths_unanswered() {
+    editor e;
+    e.query_widths();
+    e.start("> ");
+    e.feed("\x1b[1;3R");
+    CHECK(e.escape_pending());
+    e.expire_escape();
+    CHECK(!e.widths_pending() && !e.escape_pending());
+    CHECK(e.widths().is_default());
+
+    // Shift+F3 is a key again rather than a late reply
+    e.feed("a\x1b[1;2Rb");
+    CHECK(e.widths().is_default());
+    CHECK(finish(e, "\r") == "ab");
+
+    detail::key_parser parser;
+    for (auto c : std::string_view("\x1b[1;2")) {
+        parser.feed(c);
+    }
+    auto key = parser.feed('R');
+    CHECK(key && key->code == detail::key_code::f3 && key->modifiers == 1);
+}
+
+int main() {
+    sync_output_reply();
+    sync_output_unanswered();
+    sync_output_cut_off();
+    widths_reply();
+    widths_unanswered();
+
+    std::printf("%d failures\n", failures);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,105 @@
+// Checks the SIGWINCH listener on a pty that is the controlling terminal of a new session: chaining to a previous
+// SA_SIGINFO handler, falling back to polling once every slot is taken, and destroying listeners while the signal
+// keeps arriving.
+
+#include "lined/resize.hpp"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <memory>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace lined::detail;
+
+static int failures = 0;
+
+#define CHECK(cond)                                                                                                    \
+    do {                                                                                                               \
+        if (!(cond)) {                                                                                                 \
+            std::printf("%s:%d: %s\n", __FILE__, __LINE__, #cond);                                                     \
+            failures++;                                                                                                \
+        }                                                                                                              \
+    } while (0)
+
+static std::atomic<int> previous_calls = 0;
+static std::atomic<bool> previous_had_info = false;
+
+static void previous_handler(int signal, siginfo_t* info, void*) {
+    previous_calls++;
+    previous_had_info = info && info->si_signo == signal;
+}
+
+static int run() {
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    grantpt(master);
+    unlockpt(master);
+    setsid();
+    int tty = open(ptsname(master), O_RDWR);
+    if (tty == -1 || tcgetpgrp(tty) == -1) {
+        std::printf("no controlling terminal\n");
+        return EXIT_FAILURE;
+    }
+
+    struct sigaction action = {};
+    action.sa_sigaction = previous_handler;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGWINCH, &action, nullptr);
+
+    std::vector<std::unique_ptr<resize_listener>> listeners;
+    for (int i = 0; i < 65; ++i) {
+        listeners.push_back(std::make_unique<resize_listener>(tty));
+    }
+    for (int i = 0; i < 64; ++i) {
+        CHECK(listeners[i]->fd() != -1 && !listeners[i]->polled());
+    }
+    CHECK(listeners[64]->fd() == -1 && listeners[64]->polled());
+    CHECK(listeners[64]->timeout_ms() == 0 && listeners[64]->consume());
+    CHECK(listeners[64]->timeout_ms() > 0 && !listeners[64]->consume());
+
+    raise(SIGWINCH);
+    CHECK(listeners[0]->consume() && listeners[63]->consume());
+    CHECK(!listeners[0]->consume());
+    CHECK(previous_calls == 1 && previous_had_info);
+
+    // Freeing a slot makes it available again
+    listeners[0].reset();
+    resize_listener reused(tty);
+    CHECK(reused.fd() != -1);
+
+    std::atomic<bool> done = false;
+    std::thread signaller([&] {
+        while (!done) {
+            kill(getpid(), SIGWINCH);
+        }
+    });
+    for (int i = 0; i < 2000; ++i) {
+        auto& l = listeners[1 + i % 63];
+        l.reset();
+        l = std::make_unique<resize_listener>(tty);
+        CHECK(l->fd() != -1);
+    }
+    done = true;
+    signaller.join();
+
+    std::printf("%d failures\n", failures);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main() {
+    // setsid needs a process that is not already a group leader
+    auto pid = fork();
+    if (pid == 0) {
+        auto result = run();
+        std::fflush(stdout);
+        _exit(result);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_FAILURE;
+}
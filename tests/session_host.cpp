@@ -0,0 +1,100 @@
+// Serves a line_reader on a pty through a session_host, then hangs up the pty and expects the session to report
+// line_error::syscall so it can be removed, instead of spinning on the readable descriptor.
+
+#include "lined/session_host.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+using namespace lined;
+
+static int failures = 0;
+
+#define CHECK(cond)                                                                                                    \
+    do {                                                                                                               \
+        if (!(cond)) {                                                                                                 \
+            std::printf("%s:%d: %s\n", __FILE__, __LINE__, #cond);                                                     \
+            failures++;                                                                                                \
+        }                                                                                                              \
+    } while (0)
+
+struct pty
+{
+    int master = -1;
+    int slave = -1;
+
+    pty() {
+        master = posix_openpt(O_RDWR | O_NOCTTY);
+        grantpt(master);
+        unlockpt(master);
+        slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+        fcntl(master, F_SETFL, O_NONBLOCK);
+    }
+
+    ~pty() {
+        hang_up();
+        close(slave);
+    }
+
+    void drain() const {
+        char buf[4096];
+        while (read(master, buf, sizeof(buf)) > 0) {
+        }
+    }
+
+    void hang_up() {
+        if (master != -1) {
+            close(master);
+            master = -1;
+        }
+    }
+};
+
+static void session_removed_on_hang_up() {
+    pty p;
+    line_reader reader({p.slave, p.slave, 100, true, {}});
+    session_host host;
+    std::vector<line> lines;
+    host.add(reader, styled_string("> "), [&](line_reader& r, line l) {
+        if (!l) {
+            host.remove(r);
+        }
+        lines.push_back(std::move(l));
+    });
+
+    [[maybe_unused]] auto unused = write(p.master, "hi\r", 3);
+    for (int i = 0; i < 10 && lines.empty(); ++i) {
+        host.run_once(100);
+        p.drain();
+    }
+    CHECK(lines.size() == 1 && lines[0] && *lines[0] == "hi");
+
+    p.hang_up();
+    for (int i = 0; i < 10 && host.size() > 0; ++i) {
+        host.run_once(100);
+    }
+    CHECK(host.size() == 0);
+    CHECK(lines.size() == 2 && !lines[1] && lines[1].error() == line_error::syscall);
+}
+
+static void getline_returns_on_hang_up() {
+    pty p;
+    line_reader reader({p.slave, p.slave, 100, true, {}});
+    p.hang_up();
+    auto l = reader.getline("> ");
+    CHECK(!l && l.error() == line_error::syscall);
+}
+
+int main() {
+    // A reader that spins on the hung up pty never returns
+    alarm(10);
+
+    session_removed_on_hang_up();
+    getline_returns_on_hang_up();
+
+    std::printf("%d failures\n", failures);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,181 @@
+// Checks that decoding never throws and replaces ill-formed input with U+FFFD, one per maximal subpart as in the
+// Unicode standard's "U+FFFD Substitution of Maximal Subparts". The bulk decoder is compared with the byte-wise
+// utf8_decoder, including at every offset around the vectorised ASCII runs.
+
+#include "lined/utf8.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <string_view>
+
+using namespace lined::detail;
+
+static int failures = 0;
+
+static void fail(const char* what, std::string_view input) {
+    if (failures++ < 20) {
+        std::printf("%s:", what);
+        for (auto c : input) {
+            std::printf(" %02x", static_cast<uint8_t>(c));
+        }
+        std::printf("\n");
+    }
+}
+
+static std::u32string decode_bytewise(std::string_view str) {
+    utf8_decoder decoder;
+    std::u32string out;
+    std::size_t i = 0;
+    while (i < str.size()) {
+        if (auto c = decoder.write_char(str[i])) {
+            out += *c;
+        }
+        i += decoder.consumed();
+    }
+    if (decoder.in_sequence()) {
+        out += replacement_character;
+    }
+
+    return out;
+}
+
+static void check(std::string_view input, std::u32string_view expected) {
+    try {
+        if (decode_utf8(input) != expected) {
+            fail("decode_utf8", input);
+        }
+        if (decode_bytewise(input) != expected) {
+            fail("utf8_decoder", input);
+        }
+    } catch (...) {
+        fail("threw", input);
+    }
+}
+
+struct test_case
+{
+    std::string_view input;
+    std::u32string_view expected;
+};
+
+constexpr char32_t r = replacement_character;
+
+const test_case cases[] = {
+    // Well-formed, one of each length and the boundaries of each length
+    {"a", U"a"},
+    {"\x7f", U"\x7f"},
+    {"\xc2\x80", U"\x80"},
+    {"\xc3\xa9", U"\xe9"},
+    {"\xdf\xbf", U"\x7ff"},
+    {"\xe0\xa0\x80", U"\x800"},
+    {"\xe5\xad\x97", U"\x5b57"},
+    {"\xed\x9f\xbf", U"\xd7ff"},
+    {"\xee\x80\x80", U"\xe000"},
+    {"\xef\xbf\xbd", U"\xfffd"},
+    {"\xf0\x90\x80\x80", U"\x10000"},
+    {"\xf0\x9f\x98\x80", U"\x1f600"},
+    {"\xf4\x8f\xbf\xbf", U"\x10ffff"},
+    // Stray continuation bytes and bytes that never start a sequence
+    {"\x80", {&r, 1}},
+    {"\xbf\x80", {U"\xfffd\xfffd"}},
+    {"\xfe", {&r, 1}},
+    {"\xff", {&r, 1}},
+    {"a\xff" "b", U"a\xfffd" U"b"},
+    // Overlong encodings
+    {"\xc0\xaf", U"\xfffd\xfffd"},
+    {"\xc1\xbf", U"\xfffd\xfffd"},
+    {"\xe0\x80\xaf", U"\xfffd\xfffd\xfffd"},
+    {"\xe0\x9f\xbf", U"\xfffd\xfffd\xfffd"},
+    {"\xf0\x80\x80\xaf", U"\xfffd\xfffd\xfffd\xfffd"},
+    {"\xf0\x8f\xbf\xbf", U"\xfffd\xfffd\xfffd\xfffd"},
+    // Surrogates
+    {"\xed\xa0\x80", U"\xfffd\xfffd\xfffd"},
+    {"\xed\xbf\xbf", U"\xfffd\xfffd\xfffd"},
+    {"\xed\xa0\xbd\xed\xb8\x80", U"\xfffd\xfffd\xfffd\xfffd\xfffd\xfffd"},
+    // Beyond U+10FFFF
+    {"\xf4\x90\x80\x80", U"\xfffd\xfffd\xfffd\xfffd"},
+    {"\xf5\x80\x80\x80", U"\xfffd\xfffd\xfffd\xfffd"},
+    {"\xf7\xbf\xbf\xbf", U"\xfffd\xfffd\xfffd\xfffd"},
+    {"\xf8\x88\x80\x80\x80", U"\xfffd\xfffd\xfffd\xfffd\xfffd"},
+    // Truncated sequences, at the end and followed by other bytes
+    {"\xc3", {&r, 1}},
+    {"\xe2\x82", {&r, 1}},
+    {"\xf0\x9f\x98", {&r, 1}},
+    {"\xe2\x82" "a", U"\xfffd" U"a"},
+    {"\xf0\x9f\x98" "a", U"\xfffd" U"a"},
+    {"\xf0\x9f\x98\xc3\xa9", U"\xfffd\xe9"},
+    {"\xe2\x82\xe2\x82\xac", U"\xfffd\x20ac"},
+    {"\xc3\xc3\xa9", U"\xfffd\xe9"},
+};
+
+int main() {
+    for (const auto& c : cases) {
+        check(c.input, c.expected);
+    }
+
+    // The same cases inside ASCII runs of every length the vectorised paths step by
+    for (const auto& c : cases) {
+        for (std::size_t before = 0; before <= 40; ++before) {
+            for (std::size_t after : {0, 1, 15, 16, 17, 33}) {
+                std::string input(before, 'x');
+                input += c.input;
+                input.append(after, 'y');
+                std::u32string expected(before, U'x');
+                expected += c.expected;
+                expected.append(after, U'y');
+                check(input, expected);
+            }
+        }
+    }
+
+    // Random bytes, biased towards ASCII runs and lead bytes
+    std::mt19937 rng(1);
+    for (int i = 0; i < 200000; ++i) {
+        std::string input;
+        auto n = rng() % 80;
+        for (std::size_t j = 0; j < n; ++j) {
+            switch (rng() % 4) {
+            case 0:
+            case 1:
+                input += static_cast<char>('a' + rng() % 26);
+                break;
+            case 2:
+                input += static_cast<char>(0xc0 + rng() % 0x40);
+                break;
+            default:
+                input += static_cast<char>(rng());
+            }
+        }
+
+        try {
+            auto decoded = decode_utf8(input);
+            if (decoded != decode_bytewise(input)) {
+                fail("decoders disagree", input);
+            }
+            for (auto c : decoded) {
+                if (!is_encodable(c)) {
+                    fail("unencodable output", input);
+                }
+            }
+            if (decode_utf8(encode_utf8(decoded)) != decoded) {
+                fail("round trip", input);
+            }
+        } catch (...) {
+            fail("threw", input);
+        }
+    }
+
+    // Every code point round trips, and code points UTF-8 cannot carry are encoded as U+FFFD
+    for (char32_t c = 0; c < 0x110100; ++c) {
+        std::u32string in(1, c);
+        std::u32string expected(1, is_encodable(c) ? c : replacement_character);
+        auto encoded = encode_utf8(in);
+        if (encoded.size() != static_cast<std::size_t>(utf8_length(c)) || decode_utf8(encoded) != expected) {
+            fail("encode", encoded);
+        }
+    }
+
+    std::printf("%d failures\n", failures);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,58 @@
+// Throughput of the bulk UTF-8 decoder and encoder against the byte-at-a-time loops they replaced, on mostly ASCII
+// text with some two, three and four byte sequences.
+
+#include "lined/utf8.hpp"
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+using namespace lined::detail;
+
+static std::u32string decode_bytewise(std::string_view str) {
+    utf8_decoder decoder;
+    std::u32string out;
+    std::size_t i = 0;
+    while (i < str.size()) {
+        if (auto c = decoder.write_char(str[i])) {
+            out += *c;
+        }
+        i += decoder.consumed();
+    }
+
+    return out;
+}
+
+static std::string encode_bytewise(std::u32string_view str) {
+    std::string out;
+    for (auto c : str) {
+        append_utf8(out, c);
+    }
+
+    return out;
+}
+
+template <typename F>
+static void run(const char* name, std::size_t bytes, F&& f) {
+    constexpr int repeats = 50;
+    std::size_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < repeats; ++i) {
+        sink += f();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::printf("%-16s %6.2f GB/s (%zu)\n", name, repeats * bytes / elapsed.count() / 1e9, sink / repeats);
+}
+
+int main() {
+    std::string text;
+    for (int i = 0; text.size() < (1 << 22); ++i) {
+        text += "let value = compute(x, y); // ";
+        text += i % 8 == 0 ? "caf\xc3\xa9 \xe5\xad\x97 \xf0\x9f\x98\x80\n" : "plain ascii comment\n";
+    }
+    auto wide = decode_utf8(text);
+
+    run("decode bytewise", text.size(), [&] { return decode_bytewise(text).size(); });
+    run("decode_utf8", text.size(), [&] { return decode_utf8(text).size(); });
+    run("encode bytewise", text.size(), [&] { return encode_bytewise(wide).size(); });
+    run("encode_utf8", text.size(), [&] { return encode_utf8(wide).size(); });
+}
@@ -0,0 +1,76 @@
+// Checks the two-stage width table against the interval tables it is built from, for every code point and a little
+// past the end of Unicode, and that pasting a run of ASCII measures it the same as typing it one code point at a time.
+
+#include "lined/terminal_string.hpp"
+#include "lined/wcwidth9.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+using namespace lined::detail;
+
+// What wcwidth9_norm reported when it was computed from wcwidth9's binary searches.
+static int interval_width(char32_t c) {
+    auto width = wcwidth9(c);
+    if (width > 0) {
+        return width;
+    } else if (width == -1) {
+        return 0;
+    } else {
+        return 1;
+    }
+}
+
+static bool same_measure(const terminal_string& a, const terminal_string& b) {
+    if (a.text() != b.text() || a.size() != b.size() || a.total_width() != b.total_width()) {
+        return false;
+    }
+    for (std::size_t i = 0; i <= a.size(); ++i) {
+        if (a.is_boundary(i) != b.is_boundary(i) || a.byte_offset(i) != b.byte_offset(i) ||
+            (i < a.size() && a.width()[i] != b.width()[i])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Pastes between neighbours that join the clusters around them: a prepended mark, a zero width joiner, combining
+// marks and wide characters. The long run is large enough to rebuild the width trees instead of updating them.
+static std::size_t paste_mismatches() {
+    const std::u32string sides[] = {U"", U"x", U"\u0600", U"\u200d", U"e\u0301", U"\u0301\u0302", U"\u5b57"};
+    const std::u32string runs[] = {U"ab", U"a \u0301", std::u32string(300, U'k')};
+
+    std::size_t mismatches = 0;
+    for (const auto& before : sides) {
+        for (const auto& after : sides) {
+            for (const auto& run : runs) {
+                terminal_string pasted(before + after);
+                terminal_string typed(before + after);
+                pasted.insert(before.size(), run);
+                for (std::size_t i = 0; i < run.size(); ++i) {
+                    typed.insert(before.size() + i, run[i]);
+                }
+                if (!same_measure(pasted, typed) && mismatches++ < 20) {
+                    std::printf("paste of %zu code points into \"%s\"\n", run.size(), typed.to_string().c_str());
+                }
+            }
+        }
+    }
+
+    return mismatches;
+}
+
+int main() {
+    std::size_t mismatches = paste_mismatches();
+    for (char32_t c = 0; c < 0x110100; ++c) {
+        auto expected = interval_width(c);
+        auto actual = wcwidth9_norm(c);
+        if (actual != expected && mismatches++ < 20) {
+            std::printf("U+%04X: table %d, intervals %d\n", static_cast<unsigned>(c), actual, expected);
+        }
+    }
+
+    std::printf("%zu mismatches\n", mismatches);
+    return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}